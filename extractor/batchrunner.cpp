@@ -0,0 +1,173 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "batchrunner.h"
+#include "shardplan.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+BatchRunner::BatchRunner(OutputSink& sink, BufferPool& pool, unsigned int jobs, const ExtractorHelpers::ExtractOptions& options)
+    : m_sink(sink)
+    , m_pool(pool)
+    , m_jobs(jobs ? jobs : 1)
+    , m_options(options)
+    , m_checkpoint(nullptr)
+{
+}
+
+BatchStats& BatchStats::operator+=(const BatchStats& other)
+{
+    extracted += other.extracted;
+    noVideo += other.noVideo;
+    invalid += other.invalid;
+    unsupported += other.unsupported;
+    failed += other.failed;
+    readRequests += other.readRequests;
+    return *this;
+}
+
+void BatchRunner::setRoot(const std::string& root)
+{
+    m_root = root;
+    if (!m_root.empty() && m_root.back() != '/' && m_root.back() != '\\')
+    {
+        m_root += '/';
+    }
+}
+
+void BatchRunner::setCheckpoint(Checkpoint* checkpoint)
+{
+    m_checkpoint = checkpoint;
+}
+
+bool BatchRunner::readList(const std::string& listPath, std::vector<std::string>& inputs)
+{
+    std::ifstream list(listPath.c_str());
+    if (!list.is_open())
+    {
+        return false;
+    }
+    std::string line;
+    while (std::getline(list, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (!line.empty())
+        {
+            inputs.push_back(line);
+        }
+    }
+    return true;
+}
+
+BatchStats BatchRunner::run(const std::vector<std::string>& inputs)
+{
+    return runJobs(inputs, [&](VideoExtractor& extractor, size_t i) {
+        return extractor.extract(m_root + inputs[i], inputs[i]);
+    });
+}
+
+BatchStats BatchRunner::runPairs(const std::vector<LivePhotoPair>& pairs)
+{
+    std::vector<std::string> stills;
+    stills.reserve(pairs.size());
+    for (const auto& pair : pairs)
+    {
+        stills.push_back(pair.still);
+    }
+    return runJobs(stills, [&](VideoExtractor& extractor, size_t i) {
+        return extractor.extractCompanion(m_root + pairs[i].still, m_root + pairs[i].movie, pairs[i].still);
+    });
+}
+
+BatchStats BatchRunner::runJobs(const std::vector<std::string>& inputs,
+                                const std::function<ExtractorHelpers::ExtractResult(VideoExtractor&, size_t)>& job)
+{
+    BatchStats stats;
+    std::mutex statsMutex;
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        VideoExtractor extractor(m_sink, m_pool, m_options);
+        // inputs go out in list order, a list sorted by disk position
+        // reaches the disk as one ascending sweep
+        for (size_t i = next++; i < inputs.size(); i = next++)
+        {
+            ExtractorHelpers::ExtractResult result = job(extractor, i);
+            if (result == ExtractorHelpers::ExtractResult::Ok)
+            {
+                // counted and checkpointed once the outputs are durable
+                const std::string name = inputs[i];
+                m_sink.whenDurable([this, &stats, &statsMutex, name](bool durable) {
+                    if (durable && m_checkpoint)
+                    {
+                        m_checkpoint->record(name, ExtractorHelpers::ExtractResult::Ok);
+                    }
+                    std::lock_guard<std::mutex> guard(statsMutex);
+                    if (durable)
+                    {
+                        ++stats.extracted;
+                    }
+                    else
+                    {
+                        ++stats.failed;
+                        std::cerr << name << ": output lost before it was synced" << std::endl;
+                    }
+                });
+            }
+            else if (m_checkpoint)
+            {
+                m_checkpoint->record(inputs[i], result);
+            }
+
+            std::lock_guard<std::mutex> guard(statsMutex);
+            stats.readRequests += extractor.lastReadRequests();
+            switch (result)
+            {
+            case ExtractorHelpers::ExtractResult::Ok:
+                break;
+            case ExtractorHelpers::ExtractResult::NO_VIDEO:
+                ++stats.noVideo;
+                break;
+            case ExtractorHelpers::ExtractResult::INVALID_VIDEO:
+                ++stats.invalid;
+                std::cerr << inputs[i] << ": " << HeifHelpers::validationMessage(extractor.lastValidation()) << std::endl;
+                break;
+            case ExtractorHelpers::ExtractResult::UNSUPPORTED_FORMAT:
+                ++stats.unsupported;
+                break;
+            case ExtractorHelpers::ExtractResult::WRITE_ERROR:
+                ++stats.failed;
+                std::cerr << inputs[i] << ": cannot write output" << std::endl;
+                break;
+            case ExtractorHelpers::ExtractResult::NAME_TAKEN:
+                ++stats.failed;
+                std::cerr << inputs[i] << ": output name already used by another input" << std::endl;
+                break;
+            default:
+                ++stats.failed;
+                std::cerr << inputs[i] << ": cannot read input file" << std::endl;
+                break;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < m_jobs; ++i)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+    // settles the outputs still waiting, failures land in stats
+    m_sink.flush();
+    return stats;
+}
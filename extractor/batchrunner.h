@@ -0,0 +1,65 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <outputsink.h>
+#include <memorybudget.h>
+#include <videoextractor.h>
+#include <livephoto.h>
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct BatchStats
+{
+    uint64_t    extracted = 0;
+    uint64_t    noVideo = 0;
+    uint64_t    invalid = 0;
+    uint64_t    unsupported = 0;
+    uint64_t    failed = 0;
+    uint64_t    readRequests = 0;
+
+    BatchStats& operator+=(const BatchStats& other);
+};
+
+class Checkpoint;
+
+// Extracts a list of inputs on several worker threads. All workers share
+// the sink and the buffer pool, so memory stays within the pool's budget
+// however many large files happen to be in flight.
+class BatchRunner
+{
+public:
+    BatchRunner(OutputSink& sink, BufferPool& pool, unsigned int jobs, const ExtractorHelpers::ExtractOptions& options);
+
+    // inputs are relative to root when one is set
+    void setRoot(const std::string& root);
+    void setCheckpoint(Checkpoint* checkpoint);
+
+    // An input counts as extracted, and gets its checkpoint line, once
+    // the sink made its outputs durable; both runs flush the sink before
+    // returning, so the stats are final.
+    BatchStats run(const std::vector<std::string>& inputs);
+    // stores each pair's movie as the video of its still
+    BatchStats runPairs(const std::vector<LivePhotoPair>& pairs);
+
+    // one path per line, empty lines are skipped
+    static bool readList(const std::string& listPath, std::vector<std::string>& inputs);
+
+private:
+    // runs job(extractor, i) for every name, names are what the checkpoint and messages show
+    BatchStats runJobs(const std::vector<std::string>& names,
+                       const std::function<ExtractorHelpers::ExtractResult(VideoExtractor&, size_t)>& job);
+
+    OutputSink&     m_sink;
+    BufferPool&     m_pool;
+    unsigned int    m_jobs;
+    ExtractorHelpers::ExtractOptions m_options;
+    std::string     m_root;
+    Checkpoint*     m_checkpoint;
+};
+
+#endif // BATCHRUNNER_H
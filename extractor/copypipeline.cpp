@@ -0,0 +1,110 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "copypipeline.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+CopyPipeline::CopyPipeline(size_t chunkSize, size_t depth)
+    : m_chunkSize(chunkSize ? chunkSize : DEFAULT_CHUNK_SIZE)
+    , m_depth(depth ? depth : DEFAULT_DEPTH)
+    , m_writeFailed(false)
+{
+}
+
+uint64_t CopyPipeline::ringSize() const
+{
+    return static_cast<uint64_t>(m_chunkSize) * m_depth;
+}
+
+bool CopyPipeline::writeFailed() const
+{
+    return m_writeFailed;
+}
+
+bool CopyPipeline::run(HeifUtils::RangeReader& reader, uint64_t offset, uint64_t len,
+                       const HeifUtils::RangeReader::ChunkCallback& onRead, const ChunkWriter& write)
+{
+    m_writeFailed = false;
+    const size_t slots = static_cast<size_t>(std::min<uint64_t>(m_depth, (len + m_chunkSize - 1) / m_chunkSize));
+    if (slots == 0)
+    {
+        return true;
+    }
+    std::vector<std::vector<uint8_t>> ring(slots, std::vector<uint8_t>(m_chunkSize));
+    std::vector<size_t> lengths(slots, 0);
+
+    // produced and consumed only grow, slot i % slots is free once consumed passed it
+    std::mutex mutex;
+    std::condition_variable cond;
+    uint64_t produced = 0;
+    uint64_t consumed = 0;
+    bool readDone = false;
+    bool failed = false;
+
+    std::thread writer([&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cond.wait(lock, [&]() { return failed || consumed < produced || readDone; });
+            if (failed || consumed == produced)
+            {
+                return;
+            }
+            const size_t slot = static_cast<size_t>(consumed % slots);
+            const size_t slotLength = lengths[slot];
+            lock.unlock();
+            const bool ok = write(ring[slot].data(), slotLength);
+            lock.lock();
+            if (!ok)
+            {
+                m_writeFailed = true;
+                failed = true;
+                cond.notify_all();
+                return;
+            }
+            ++consumed;
+            cond.notify_all();
+        }
+    });
+
+    uint64_t pos = 0;
+    while (pos < len)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]() { return failed || produced - consumed < slots; });
+        if (failed)
+        {
+            break;
+        }
+        const size_t slot = static_cast<size_t>(produced % slots);
+        lock.unlock();
+
+        const size_t n = static_cast<size_t>(std::min<uint64_t>(m_chunkSize, len - pos));
+        const bool ok = reader.read(offset + pos, n, ring[slot].data())
+            && (!onRead || onRead(ring[slot].data(), n));
+
+        lock.lock();
+        if (!ok)
+        {
+            failed = true;
+            cond.notify_all();
+            break;
+        }
+        lengths[slot] = n;
+        ++produced;
+        pos += n;
+        cond.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        readDone = true;
+        cond.notify_all();
+    }
+    writer.join();
+    return !failed;
+}
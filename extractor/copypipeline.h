@@ -0,0 +1,42 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef COPYPIPELINE_H
+#define COPYPIPELINE_H
+
+#include <rangereader.h>
+
+#include <stdint.h>
+#include <functional>
+
+// Copies a range with a reader and a writer thread over a ring of
+// fixed-size buffers, so reading chunk N + 1 overlaps writing chunk N.
+// Pays off when both ends are slow storage (network mounts) and the
+// kernel can't copy between them by itself.
+class CopyPipeline
+{
+public:
+    static const size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+    static const size_t DEFAULT_DEPTH = 4;
+
+    typedef std::function<bool(const uint8_t* data, size_t len)> ChunkWriter;
+
+    CopyPipeline(size_t chunkSize, size_t depth);
+
+    // memory the ring takes while run() is active
+    uint64_t ringSize() const;
+
+    // Reads [offset, offset + len) on the calling thread, onRead sees each
+    // chunk before it's queued (hashing), write runs on the writer thread.
+    // Stops at the first failure of either side.
+    bool run(HeifUtils::RangeReader& reader, uint64_t offset, uint64_t len,
+             const HeifUtils::RangeReader::ChunkCallback& onRead, const ChunkWriter& write);
+
+    bool writeFailed() const;
+
+private:
+    size_t  m_chunkSize;
+    size_t  m_depth;
+    bool    m_writeFailed;
+};
+
+#endif // COPYPIPELINE_H
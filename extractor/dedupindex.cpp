@@ -0,0 +1,34 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "dedupindex.h"
+
+std::string DedupIndex::key(const ExtractorHelpers::PayloadInfo& info)
+{
+    return std::to_string(info.size) + ':' + info.xxh64 + ':' + info.sha256;
+}
+
+bool DedupIndex::find(const ExtractorHelpers::PayloadInfo& info, ExtractorHelpers::OutputRef& original)
+{
+    if (info.sha256.empty())
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(m_mutex);
+    auto it = m_seen.find(key(info));
+    if (it == m_seen.end())
+    {
+        return false;
+    }
+    original = it->second;
+    return true;
+}
+
+void DedupIndex::add(const ExtractorHelpers::PayloadInfo& info, const ExtractorHelpers::OutputRef& ref)
+{
+    if (info.sha256.empty())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_seen.insert(std::make_pair(key(info), ref));
+}
@@ -0,0 +1,30 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef DEDUPINDEX_H
+#define DEDUPINDEX_H
+
+#include <outputsink.h>
+
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+// Payloads already written in this run, keyed by size, XXH64 and
+// SHA-256. XXH64 alone isn't collision resistant, so payloads without a
+// SHA-256 are never matched: a duplicate is only referenced when its
+// bytes are the original's. Two workers finishing the same payload at
+// once may both write it, which costs space but never loses data.
+class DedupIndex
+{
+public:
+    bool find(const ExtractorHelpers::PayloadInfo& info, ExtractorHelpers::OutputRef& original);
+    void add(const ExtractorHelpers::PayloadInfo& info, const ExtractorHelpers::OutputRef& ref);
+
+private:
+    static std::string key(const ExtractorHelpers::PayloadInfo& info);
+
+    std::mutex                                                  m_mutex;
+    std::unordered_map<std::string, ExtractorHelpers::OutputRef> m_seen;
+};
+
+#endif // DEDUPINDEX_H
@@ -0,0 +1,302 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "hash.h"
+
+#include <string.h>
+
+namespace
+{
+    const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+    const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+    inline uint64_t rotl64(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline uint64_t read64le(const uint8_t* p)
+    {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+        {
+            v = (v << 8) | p[i];
+        }
+        return v;
+    }
+
+    inline uint32_t read32le(const uint8_t* p)
+    {
+        return static_cast<uint32_t>(p[0])
+            | (static_cast<uint32_t>(p[1]) << 8)
+            | (static_cast<uint32_t>(p[2]) << 16)
+            | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    inline uint64_t xxhRound(uint64_t acc, uint64_t input)
+    {
+        acc += input * PRIME64_2;
+        acc = rotl64(acc, 31);
+        return acc * PRIME64_1;
+    }
+
+    inline uint64_t xxhMergeRound(uint64_t acc, uint64_t val)
+    {
+        acc ^= xxhRound(0, val);
+        return acc * PRIME64_1 + PRIME64_4;
+    }
+}
+
+Xxh64::Xxh64(uint64_t seed)
+    : m_seed(seed)
+    , m_totalLen(0)
+    , m_bufferSize(0)
+{
+    m_acc[0] = seed + PRIME64_1 + PRIME64_2;
+    m_acc[1] = seed + PRIME64_2;
+    m_acc[2] = seed;
+    m_acc[3] = seed - PRIME64_1;
+}
+
+void Xxh64::update(const uint8_t* data, size_t len)
+{
+    m_totalLen += len;
+
+    if (m_bufferSize + len < 32)
+    {
+        memcpy(m_buffer + m_bufferSize, data, len);
+        m_bufferSize += len;
+        return;
+    }
+
+    if (m_bufferSize)
+    {
+        size_t fill = 32 - m_bufferSize;
+        memcpy(m_buffer + m_bufferSize, data, fill);
+        for (int i = 0; i < 4; ++i)
+        {
+            m_acc[i] = xxhRound(m_acc[i], read64le(m_buffer + i * 8));
+        }
+        data += fill;
+        len -= fill;
+        m_bufferSize = 0;
+    }
+
+    while (len >= 32)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            m_acc[i] = xxhRound(m_acc[i], read64le(data + i * 8));
+        }
+        data += 32;
+        len -= 32;
+    }
+
+    if (len)
+    {
+        memcpy(m_buffer, data, len);
+        m_bufferSize = len;
+    }
+}
+
+uint64_t Xxh64::digest() const
+{
+    uint64_t h = 0;
+    if (m_totalLen >= 32)
+    {
+        h = rotl64(m_acc[0], 1) + rotl64(m_acc[1], 7) + rotl64(m_acc[2], 12) + rotl64(m_acc[3], 18);
+        for (int i = 0; i < 4; ++i)
+        {
+            h = xxhMergeRound(h, m_acc[i]);
+        }
+    }
+    else
+    {
+        h = m_seed + PRIME64_5;
+    }
+    h += m_totalLen;
+
+    const uint8_t* p = m_buffer;
+    size_t left = m_bufferSize;
+    while (left >= 8)
+    {
+        h ^= xxhRound(0, read64le(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+        left -= 8;
+    }
+    if (left >= 4)
+    {
+        h ^= static_cast<uint64_t>(read32le(p)) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        left -= 4;
+    }
+    while (left)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        ++p;
+        --left;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string Xxh64::hexDigest() const
+{
+    static const char hexChars[] = "0123456789abcdef";
+    uint64_t value = digest();
+    std::string res(16, '0');
+    for (int i = 15; i >= 0; --i)
+    {
+        res[i] = hexChars[value & 0xf];
+        value >>= 4;
+    }
+    return res;
+}
+
+namespace
+{
+    const uint32_t SHA256_K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    inline uint32_t rotr32(uint32_t x, int r)
+    {
+        return (x >> r) | (x << (32 - r));
+    }
+}
+
+Sha256::Sha256()
+    : m_totalLen(0)
+    , m_bufferSize(0)
+{
+    m_state[0] = 0x6a09e667;
+    m_state[1] = 0xbb67ae85;
+    m_state[2] = 0x3c6ef372;
+    m_state[3] = 0xa54ff53a;
+    m_state[4] = 0x510e527f;
+    m_state[5] = 0x9b05688c;
+    m_state[6] = 0x1f83d9ab;
+    m_state[7] = 0x5be0cd19;
+}
+
+void Sha256::transform(const uint8_t* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (static_cast<uint32_t>(block[i * 4]) << 24)
+            | (static_cast<uint32_t>(block[i * 4 + 1]) << 16)
+            | (static_cast<uint32_t>(block[i * 4 + 2]) << 8)
+            | static_cast<uint32_t>(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + SHA256_K[i] + w[i];
+        uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    m_state[0] += a;
+    m_state[1] += b;
+    m_state[2] += c;
+    m_state[3] += d;
+    m_state[4] += e;
+    m_state[5] += f;
+    m_state[6] += g;
+    m_state[7] += h;
+}
+
+void Sha256::update(const uint8_t* data, size_t len)
+{
+    m_totalLen += len;
+    if (m_bufferSize)
+    {
+        size_t fill = 64 - m_bufferSize;
+        if (len < fill)
+        {
+            memcpy(m_buffer + m_bufferSize, data, len);
+            m_bufferSize += len;
+            return;
+        }
+        memcpy(m_buffer + m_bufferSize, data, fill);
+        transform(m_buffer);
+        data += fill;
+        len -= fill;
+        m_bufferSize = 0;
+    }
+    while (len >= 64)
+    {
+        transform(data);
+        data += 64;
+        len -= 64;
+    }
+    if (len)
+    {
+        memcpy(m_buffer, data, len);
+        m_bufferSize = len;
+    }
+}
+
+std::string Sha256::hexDigest() const
+{
+    // pad a copy, the running state stays usable
+    Sha256 tail(*this);
+    uint64_t bitLen = m_totalLen * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t padLen = (m_bufferSize < 56) ? (56 - m_bufferSize) : (120 - m_bufferSize);
+    tail.update(pad, padLen);
+    uint8_t lenBytes[8];
+    for (int i = 0; i < 8; ++i)
+    {
+        lenBytes[i] = static_cast<uint8_t>(bitLen >> (56 - i * 8));
+    }
+    tail.update(lenBytes, 8);
+
+    static const char hexChars[] = "0123456789abcdef";
+    std::string res;
+    res.reserve(64);
+    for (int i = 0; i < 8; ++i)
+    {
+        for (int shift = 28; shift >= 0; shift -= 4)
+        {
+            res.push_back(hexChars[(tail.m_state[i] >> shift) & 0xf]);
+        }
+    }
+    return res;
+}
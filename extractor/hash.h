@@ -0,0 +1,44 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <string>
+
+// Streaming XXH64, so payloads can be hashed chunk by chunk while copied.
+class Xxh64
+{
+public:
+    Xxh64(uint64_t seed = 0);
+
+    void update(const uint8_t* data, size_t len);
+    uint64_t digest() const;
+    std::string hexDigest() const;
+
+private:
+    uint64_t    m_acc[4];
+    uint64_t    m_seed;
+    uint64_t    m_totalLen;
+    uint8_t     m_buffer[32];
+    size_t      m_bufferSize;
+};
+
+class Sha256
+{
+public:
+    Sha256();
+
+    void update(const uint8_t* data, size_t len);
+    std::string hexDigest() const;
+
+private:
+    void transform(const uint8_t* block);
+
+    uint32_t    m_state[8];
+    uint64_t    m_totalLen;
+    uint8_t     m_buffer[64];
+    size_t      m_bufferSize;
+};
+
+#endif // HASH_H
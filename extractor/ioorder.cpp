@@ -0,0 +1,142 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "ioorder.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+namespace
+{
+    std::string join_path(const std::string& root, const std::string& path)
+    {
+        if (root.empty() || root.back() == '/' || root.back() == '\\')
+        {
+            return root + path;
+        }
+        return root + '/' + path;
+    }
+
+    bool physical_offset(const std::string& path, uint64_t& offset)
+    {
+#ifdef __linux__
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        // fiemap header followed by room for one extent
+        uint64_t request[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(uint64_t) + 1];
+        memset(request, 0, sizeof(request));
+        struct fiemap* map = reinterpret_cast<struct fiemap*>(request);
+        map->fm_start = 0;
+        map->fm_length = ~0ULL;
+        map->fm_extent_count = 1;
+        bool ok = ioctl(fd, FS_IOC_FIEMAP, map) == 0
+            && map->fm_mapped_extents == 1
+            && !(map->fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN);
+        ::close(fd);
+        if (ok)
+        {
+            offset = map->fm_extents[0].fe_physical;
+        }
+        return ok;
+#else
+        (void)path;
+        (void)offset;
+        return false;
+#endif
+    }
+
+    bool inode_number(const std::string& path, uint64_t& inode)
+    {
+#ifdef _WIN32
+        (void)path;
+        (void)inode;
+        return false;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+        {
+            return false;
+        }
+        inode = static_cast<uint64_t>(st.st_ino);
+        return true;
+#endif
+    }
+
+    bool sort_by(std::vector<std::string>& inputs, const std::string& root,
+                 bool (*key)(const std::string&, uint64_t&))
+    {
+        std::vector<std::pair<uint64_t, size_t>> keys;
+        keys.reserve(inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            uint64_t value = 0;
+            if (!key(join_path(root, inputs[i]), value))
+            {
+                // unmapped (or missing) files go last, in list order
+                value = UINT64_MAX;
+            }
+            keys.emplace_back(value, i);
+        }
+
+        size_t known = std::count_if(keys.begin(), keys.end(),
+                                     [](const std::pair<uint64_t, size_t>& k) { return k.first != UINT64_MAX; });
+        if (known == 0)
+        {
+            return false;
+        }
+
+        std::stable_sort(keys.begin(), keys.end());
+        std::vector<std::string> sorted;
+        sorted.reserve(inputs.size());
+        for (const auto& k : keys)
+        {
+            sorted.push_back(std::move(inputs[k.second]));
+        }
+        inputs.swap(sorted);
+        return true;
+    }
+}
+
+namespace IoOrder
+{
+    Method sortByPhysicalLayout(std::vector<std::string>& inputs, const std::string& root)
+    {
+        if (sort_by(inputs, root, physical_offset))
+        {
+            return Method::PHYSICAL;
+        }
+        if (sort_by(inputs, root, inode_number))
+        {
+            return Method::INODE;
+        }
+        return Method::LIST;
+    }
+
+    const char* methodName(Method method)
+    {
+        switch (method)
+        {
+        case Method::PHYSICAL:
+            return "physical extents";
+        case Method::INODE:
+            return "inode numbers";
+        default:
+            return "list order";
+        }
+    }
+}
@@ -0,0 +1,29 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef IOORDER_H
+#define IOORDER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Batch ordering for rotational disks: inputs are sorted by where their
+// data starts on the device (FIEMAP), so the heads sweep the archive once
+// instead of seeking back and forth in directory order. Where extents
+// can't be queried the inode number is used, which most file systems
+// allocate roughly in disk order.
+namespace IoOrder
+{
+    enum class Method
+    {
+        LIST,       // keep the list order
+        PHYSICAL,   // first extent offset
+        INODE,      // fallback
+    };
+
+    // reorders paths (joined with root for lookup), returns the method used
+    Method sortByPhysicalLayout(std::vector<std::string>& inputs, const std::string& root);
+    const char* methodName(Method method);
+}
+
+#endif // IOORDER_H
@@ -0,0 +1,628 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "livephoto.h"
+
+#include "readplanner.h"
+#include "videoextractor.h"
+
+#include <heifreader.h>
+#include <isobmff.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <thread>
+#include <unordered_map>
+#include <string.h>
+
+namespace
+{
+    const char APPLE_MAKERNOTE_ID[] = "Apple iOS";      // NUL terminated in the file
+    const char XMP_ID[] = "http://ns.adobe.com/xap/1.0/";
+    const char QUICKTIME_CONTENT_ID_KEY[] = "com.apple.quicktime.content.identifier";
+    const uint16_t TIFF_TAG_EXIF_IFD = 0x8769;
+    const uint16_t TIFF_TAG_MAKERNOTE = 0x927C;
+    const uint16_t APPLE_TAG_CONTENT_ID = 0x0011;
+
+    // Bounds checked IFD lookups over a TIFF structure in memory,
+    // offsets are relative to data as TIFF and MakerNote IFDs use them.
+    class TiffView
+    {
+    public:
+        TiffView(const uint8_t* data, size_t size, bool bigEndian)
+            : m_data(data)
+            , m_size(size)
+            , m_bigEndian(bigEndian)
+        {
+        }
+
+        bool u16(size_t pos, uint16_t& value) const
+        {
+            if (pos > m_size || m_size - pos < 2)
+            {
+                return false;
+            }
+            const uint8_t* p = m_data + pos;
+            value = m_bigEndian ? static_cast<uint16_t>((p[0] << 8) | p[1])
+                                : static_cast<uint16_t>((p[1] << 8) | p[0]);
+            return true;
+        }
+
+        bool u32(size_t pos, uint32_t& value) const
+        {
+            uint16_t a = 0;
+            uint16_t b = 0;
+            if (!u16(pos, a) || !u16(pos + 2, b))
+            {
+                return false;
+            }
+            value = m_bigEndian ? ((static_cast<uint32_t>(a) << 16) | b)
+                                : ((static_cast<uint32_t>(b) << 16) | a);
+            return true;
+        }
+
+        // position and length of a tag's value, inline values live in the entry itself
+        bool findTag(size_t ifd, uint16_t tag, uint16_t& type, uint32_t& count, size_t& valuePos) const
+        {
+            static const uint32_t TYPE_SIZES[] = { 0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8 };
+            uint16_t entries = 0;
+            if (!u16(ifd, entries))
+            {
+                return false;
+            }
+            for (uint16_t i = 0; i < entries; ++i)
+            {
+                const size_t entry = ifd + 2 + static_cast<size_t>(i) * 12;
+                uint16_t entryTag = 0;
+                if (!u16(entry, entryTag) || !u16(entry + 2, type) || !u32(entry + 4, count))
+                {
+                    return false;
+                }
+                if (entryTag != tag)
+                {
+                    continue;
+                }
+                const uint64_t typeSize = (type < sizeof(TYPE_SIZES) / sizeof(TYPE_SIZES[0])) ? TYPE_SIZES[type] : 1;
+                const uint64_t length = typeSize * count;
+                if (length <= 4)
+                {
+                    valuePos = entry + 8;
+                }
+                else
+                {
+                    uint32_t offset = 0;
+                    if (!u32(entry + 8, offset))
+                    {
+                        return false;
+                    }
+                    valuePos = offset;
+                }
+                return valuePos <= m_size && length <= m_size - valuePos;
+            }
+            return false;
+        }
+
+    private:
+        const uint8_t*  m_data;
+        size_t          m_size;
+        bool            m_bigEndian;
+    };
+
+    std::string printable(const char* str, size_t len)
+    {
+        std::string res(str, strnlen(str, len));
+        while (!res.empty() && (res.back() == ' ' || res.back() == '\n' || res.back() == '\r'))
+        {
+            res.pop_back();
+        }
+        for (unsigned char c : res)
+        {
+            if (c < 0x20 || c > 0x7e)
+            {
+                return std::string();
+            }
+        }
+        return res;
+    }
+
+    // Exif TIFF -> Exif IFD -> MakerNote -> Apple tag 0x0011
+    std::string apple_content_identifier(const uint8_t* tiff, size_t size)
+    {
+        if (size < 8 || (memcmp(tiff, "II", 2) != 0 && memcmp(tiff, "MM", 2) != 0))
+        {
+            return std::string();
+        }
+        TiffView exif(tiff, size, tiff[0] == 'M');
+        uint32_t ifd0 = 0;
+        uint32_t exifIfd = 0;
+        uint16_t type = 0;
+        uint32_t count = 0;
+        size_t valuePos = 0;
+        if (!exif.u32(4, ifd0)
+            || !exif.findTag(ifd0, TIFF_TAG_EXIF_IFD, type, count, valuePos)
+            || !exif.u32(valuePos, exifIfd)
+            || !exif.findTag(exifIfd, TIFF_TAG_MAKERNOTE, type, count, valuePos))
+        {
+            return std::string();
+        }
+
+        // "Apple iOS\0", version, byte order, then an IFD whose offsets
+        // count from the MakerNote start
+        const uint8_t* makerNote = tiff + valuePos;
+        const size_t makerNoteSize = count;
+        if (makerNoteSize < 16 || memcmp(makerNote, APPLE_MAKERNOTE_ID, sizeof(APPLE_MAKERNOTE_ID)) != 0)
+        {
+            return std::string();
+        }
+        TiffView apple(makerNote, makerNoteSize, memcmp(makerNote + 12, "II", 2) != 0);
+        if (!apple.findTag(14, APPLE_TAG_CONTENT_ID, type, count, valuePos) || type != 2)
+        {
+            return std::string();
+        }
+        return printable(reinterpret_cast<const char*>(makerNote + valuePos), count);
+    }
+
+    // ContentIdentifier="..." or <x:ContentIdentifier>...</x:ContentIdentifier>
+    // in any namespace prefix, as export tools write it
+    std::string xmp_content_identifier(const uint8_t* data, size_t size)
+    {
+        static const std::string PROPERTY = "ContentIdentifier";
+        const char* begin = reinterpret_cast<const char*>(data);
+        const char* end = begin + size;
+        const char* pos = std::search(begin, end, PROPERTY.begin(), PROPERTY.end());
+        if (pos == end)
+        {
+            return std::string();
+        }
+        pos += PROPERTY.size();
+        while (pos != end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n'))
+        {
+            ++pos;
+        }
+        char terminator = 0;
+        if (pos != end && *pos == '=')
+        {
+            ++pos;
+            while (pos != end && *pos == ' ')
+            {
+                ++pos;
+            }
+            if (pos == end || (*pos != '"' && *pos != '\''))
+            {
+                return std::string();
+            }
+            terminator = *pos++;
+        }
+        else if (pos != end && *pos == '>')
+        {
+            ++pos;
+            terminator = '<';
+        }
+        else
+        {
+            return std::string();
+        }
+        const char* valueEnd = std::find(pos, end, terminator);
+        return (valueEnd == end) ? std::string() : printable(pos, static_cast<size_t>(valueEnd - pos));
+    }
+
+    std::string jpeg_identifier(HeifUtils::RangeReader& reader, MemoryBudget& budget)
+    {
+        int64_t size = reader.size();
+        uint8_t soi[2];
+        if (size < 4 || !reader.read(0, 2, soi) || soi[0] != 0xFF || soi[1] != 0xD8)
+        {
+            return std::string();
+        }
+
+        // APPn segments only, the scan data is never touched
+        std::string xmpIdentifier;
+        uint64_t pos = 2;
+        while (pos + 4 <= static_cast<uint64_t>(size))
+        {
+            uint8_t marker[4];
+            if (!reader.read(pos, 4, marker) || marker[0] != 0xFF)
+            {
+                break;
+            }
+            if (marker[1] == 0xFF)
+            {
+                // fill byte
+                ++pos;
+                continue;
+            }
+            if (marker[1] == 0xDA || marker[1] == 0xD9)
+            {
+                break;
+            }
+            if (marker[1] == 0x01 || (marker[1] >= 0xD0 && marker[1] <= 0xD7))
+            {
+                pos += 2;
+                continue;
+            }
+            const size_t segmentSize = (static_cast<size_t>(marker[2]) << 8) | marker[3];
+            if (segmentSize < 2 || pos + 2 + segmentSize > static_cast<uint64_t>(size))
+            {
+                break;
+            }
+            if (marker[1] == 0xE1)
+            {
+                // 64 KiB at most
+                BudgetGuard segmentGuard(budget, segmentSize - 2, false);
+                std::vector<uint8_t> segment(segmentSize - 2);
+                if (!reader.read(pos + 4, segment.size(), segment.data()))
+                {
+                    break;
+                }
+                if (segment.size() > 6 && memcmp(segment.data(), "Exif\0\0", 6) == 0)
+                {
+                    std::string id = apple_content_identifier(segment.data() + 6, segment.size() - 6);
+                    if (!id.empty())
+                    {
+                        return id;
+                    }
+                }
+                else if (segment.size() > sizeof(XMP_ID) && memcmp(segment.data(), XMP_ID, sizeof(XMP_ID)) == 0)
+                {
+                    xmpIdentifier = xmp_content_identifier(segment.data() + sizeof(XMP_ID), segment.size() - sizeof(XMP_ID));
+                }
+            }
+            pos += 2 + segmentSize;
+        }
+        return xmpIdentifier;
+    }
+
+    // item holds the budget charge of itemGuard
+    bool read_heif_item(HeifUtils::RangeReader& reader, const HeifReader& heif, const std::string& itemType,
+                        MemoryBudget& budget, std::unique_ptr<BudgetGuard>& itemGuard, std::vector<uint8_t>& item)
+    {
+        uint64_t offset = 0;
+        uint64_t length = 0;
+        if (!heif.getItemLocation(itemType, offset, length) || length > LivePhotoIndex::METADATA_LIMIT)
+        {
+            return false;
+        }
+        // the previous item goes first, never wait holding bytes
+        std::vector<uint8_t>().swap(item);
+        itemGuard.reset();
+        itemGuard.reset(new BudgetGuard(budget, length));
+        item.resize(static_cast<size_t>(length));
+        return reader.read(offset, item.size(), item.data());
+    }
+
+    std::string heic_identifier(HeifUtils::RangeReader& reader, MemoryBudget& budget)
+    {
+        HeifReader heif;
+        // a Samsung motion photo in the same tree mustn't pull its video in
+        heif.setSefdReadLimit(VideoExtractor::SEFD_PROBE_SIZE);
+        if (HeifHelpers::OperationResult::Ok != heif.load(reader))
+        {
+            return std::string();
+        }
+        BudgetGuard headerGuard(budget, heif.getHeldSize(), false);
+
+        std::unique_ptr<BudgetGuard> itemGuard;
+        std::vector<uint8_t> item;
+        if (read_heif_item(reader, heif, "Exif", budget, itemGuard, item) && item.size() > 4)
+        {
+            // the item starts with the offset of the TIFF header
+            const size_t tiff = 4 + ((static_cast<size_t>(item[0]) << 24) | (static_cast<size_t>(item[1]) << 16)
+                | (static_cast<size_t>(item[2]) << 8) | item[3]);
+            if (tiff < item.size())
+            {
+                std::string id = apple_content_identifier(item.data() + tiff, item.size() - tiff);
+                if (!id.empty())
+                {
+                    return id;
+                }
+            }
+        }
+        if (read_heif_item(reader, heif, "mime", budget, itemGuard, item))
+        {
+            return xmp_content_identifier(item.data(), item.size());
+        }
+        return std::string();
+    }
+
+    // QuickTime metadata: keys names the entries, ilst holds them
+    // in boxes whose type is the 1-based key index
+    std::string quicktime_content_identifier(const IsobmffWalker& walker, const IsobmffBox& moov)
+    {
+        IsobmffBox meta;
+        if (!walker.findChild(moov, "meta", meta))
+        {
+            return std::string();
+        }
+        // QuickTime meta has no version/flags, the ISO one does
+        IsobmffBox content = meta;
+        IsobmffBox probe;
+        if (!walker.readBox(meta.payloadOffset(), meta.end(), probe))
+        {
+            content.headerSize += 4;
+        }
+        IsobmffBox keys, ilst;
+        if (content.size < content.headerSize
+            || !walker.findChild(content, "keys", keys)
+            || !walker.findChild(content, "ilst", ilst))
+        {
+            return std::string();
+        }
+
+        if (keys.end() - keys.payloadOffset() < 8)
+        {
+            return std::string();
+        }
+        uint64_t pos = keys.payloadOffset() + 8;
+        const uint32_t keyCount = walker.readU32(keys.payloadOffset() + 4);
+        uint32_t keyIndex = 0;
+        for (uint32_t i = 1; i <= keyCount && keys.end() - pos >= 8; ++i)
+        {
+            const uint32_t keySize = walker.readU32(pos);
+            if (keySize < 8 || keySize > keys.end() - pos)
+            {
+                return std::string();
+            }
+            const std::string name(reinterpret_cast<const char*>(walker.data() + pos + 8), keySize - 8);
+            if (name == QUICKTIME_CONTENT_ID_KEY)
+            {
+                keyIndex = i;
+                break;
+            }
+            pos += keySize;
+        }
+        if (keyIndex == 0)
+        {
+            return std::string();
+        }
+
+        // item types are key indexes, not printable, so no IsobmffWalker here
+        pos = ilst.payloadOffset();
+        while (ilst.end() - pos >= 8)
+        {
+            const uint32_t itemSize = walker.readU32(pos);
+            if (itemSize < 8 || itemSize > ilst.end() - pos)
+            {
+                break;
+            }
+            if (walker.readU32(pos + 4) == keyIndex)
+            {
+                IsobmffBox item;
+                item.offset = pos;
+                item.headerSize = 8;
+                item.size = itemSize;
+                IsobmffBox data;
+                // type indicator and locale come before the value
+                if (walker.findChild(item, "data", data) && data.end() - data.payloadOffset() > 8)
+                {
+                    return printable(reinterpret_cast<const char*>(walker.data() + data.payloadOffset() + 8),
+                                     static_cast<size_t>(data.end() - data.payloadOffset() - 8));
+                }
+                break;
+            }
+            pos += itemSize;
+        }
+        return std::string();
+    }
+
+    bool ends_with_nocase(const std::string& str, const std::string& suffix)
+    {
+        if (str.size() < suffix.size())
+        {
+            return false;
+        }
+        // suffix is lower case
+        return std::equal(suffix.begin(), suffix.end(), str.end() - suffix.size(),
+                          [](char s, char c) { return s == tolower(static_cast<unsigned char>(c)); });
+    }
+}
+
+LivePhotoIndex::LivePhotoIndex(unsigned int jobs, MemoryBudget& budget, const ReaderFactory& openReader)
+    : m_jobs(jobs ? jobs : 1)
+    , m_budget(budget)
+    , m_openReader(openReader)
+    , m_unpairedStills(0)
+    , m_unpairedMovies(0)
+    , m_readRequests(0)
+{
+}
+
+void LivePhotoIndex::setRoot(const std::string& root)
+{
+    m_root = root;
+    if (!m_root.empty() && m_root.back() != '/' && m_root.back() != '\\')
+    {
+        m_root += '/';
+    }
+}
+
+bool LivePhotoIndex::isStill(const std::string& path)
+{
+    return VideoExtractor::isSupported(path);
+}
+
+bool LivePhotoIndex::isMovie(const std::string& path)
+{
+    return ends_with_nocase(path, ".mov");
+}
+
+std::string LivePhotoIndex::stillIdentifier(HeifUtils::RangeReader& reader, bool heic, MemoryBudget& budget)
+{
+    return heic ? heic_identifier(reader, budget) : jpeg_identifier(reader, budget);
+}
+
+std::string LivePhotoIndex::movieIdentifier(HeifUtils::RangeReader& reader, MemoryBudget& budget)
+{
+    const int64_t size = reader.size();
+    if (size < 8)
+    {
+        return std::string();
+    }
+    const uint64_t length = static_cast<uint64_t>(size);
+
+    // top-level headers only: the iPhone writes moov behind the media data
+    uint64_t pos = 0;
+    while (length - pos >= 8)
+    {
+        uint8_t header[16];
+        const size_t headerSize = (length - pos >= 16) ? 16 : 8;
+        if (!reader.read(pos, headerSize, header))
+        {
+            return std::string();
+        }
+        IsobmffWalker walker(header, headerSize);
+        uint64_t boxSize = walker.readU32(0);
+        if (boxSize == 1 && headerSize == 16)
+        {
+            boxSize = walker.readU64(8);
+        }
+        else if (boxSize == 0)
+        {
+            boxSize = length - pos;
+        }
+        if (boxSize < 8 || boxSize > length - pos)
+        {
+            return std::string();
+        }
+
+        if (memcmp(header + 4, "moov", 4) == 0)
+        {
+            if (boxSize > METADATA_LIMIT)
+            {
+                return std::string();
+            }
+            BudgetGuard moovGuard(budget, boxSize);
+            std::vector<uint8_t> moovData(static_cast<size_t>(boxSize));
+            if (!reader.read(pos, moovData.size(), moovData.data()))
+            {
+                return std::string();
+            }
+            IsobmffWalker moovWalker(moovData.data(), moovData.size());
+            IsobmffBox moov;
+            if (!moovWalker.readBox(0, moovData.size(), moov))
+            {
+                return std::string();
+            }
+            return quicktime_content_identifier(moovWalker, moov);
+        }
+        pos += boxSize;
+    }
+    return std::string();
+}
+
+void LivePhotoIndex::scan(const std::vector<std::string>& inputs)
+{
+    std::vector<std::string> identifiers(inputs.size());
+    std::atomic<size_t> next(0);
+    std::atomic<uint64_t> requests(0);
+
+    // each worker only writes the slots it claimed, no lock needed
+    auto worker = [&]() {
+        for (size_t i = next++; i < inputs.size(); i = next++)
+        {
+            const bool movie = isMovie(inputs[i]);
+            if (!movie && !isStill(inputs[i]))
+            {
+                continue;
+            }
+            const std::string path = m_root + inputs[i];
+            std::unique_ptr<HeifUtils::RangeReader> backend;
+            if (m_openReader)
+            {
+                backend = m_openReader(path);
+            }
+            else
+            {
+                std::unique_ptr<HeifUtils::FileRangeReader> file(new HeifUtils::FileRangeReader(path));
+                if (file->isOpen())
+                {
+                    backend = std::move(file);
+                }
+            }
+            if (!backend)
+            {
+                continue;
+            }
+            ReadPlanner reader(*backend);
+            reader.setBudget(&m_budget);
+            if (reader.prefetch())
+            {
+                identifiers[i] = movie ? movieIdentifier(reader, m_budget)
+                                       : stillIdentifier(reader, VideoExtractor::isHeic(path), m_budget);
+            }
+            requests += backend->requestCount();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < m_jobs; ++i)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+    m_readRequests += requests;
+
+    // the first movie wins when a clip was copied around
+    std::unordered_map<std::string, size_t> movies;
+    movies.reserve(inputs.size());
+    uint64_t movieCount = 0;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (isMovie(inputs[i]))
+        {
+            ++movieCount;
+            if (!identifiers[i].empty())
+            {
+                movies.emplace(identifiers[i], i);
+            }
+        }
+    }
+
+    std::vector<bool> used(inputs.size(), false);
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (isMovie(inputs[i]) || !isStill(inputs[i]))
+        {
+            continue;
+        }
+        auto it = identifiers[i].empty() ? movies.end() : movies.find(identifiers[i]);
+        if (it == movies.end())
+        {
+            ++m_unpairedStills;
+            continue;
+        }
+        LivePhotoPair pair;
+        pair.still = inputs[i];
+        pair.movie = inputs[it->second];
+        m_pairs.push_back(pair);
+        if (!used[it->second])
+        {
+            used[it->second] = true;
+            --movieCount;
+        }
+    }
+    m_unpairedMovies += movieCount;
+}
+
+const std::vector<LivePhotoPair>& LivePhotoIndex::pairs() const
+{
+    return m_pairs;
+}
+
+uint64_t LivePhotoIndex::unpairedStills() const
+{
+    return m_unpairedStills;
+}
+
+uint64_t LivePhotoIndex::unpairedMovies() const
+{
+    return m_unpairedMovies;
+}
+
+uint64_t LivePhotoIndex::readRequests() const
+{
+    return m_readRequests;
+}
@@ -0,0 +1,65 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef LIVEPHOTO_H
+#define LIVEPHOTO_H
+
+#include <rangereader.h>
+#include <memorybudget.h>
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct LivePhotoPair
+{
+    std::string still;
+    std::string movie;
+};
+
+// Apple Live Photos keep the clip in a .MOV next to the still. Both carry
+// the same content identifier: the still in its Apple MakerNote (or XMP),
+// the movie in its QuickTime metadata. scan() reads every file's headers
+// once and joins the two sides through a hash map, so pairing is linear in
+// the number of files however they are spread over directories.
+class LivePhotoIndex
+{
+public:
+    typedef std::function<std::unique_ptr<HeifUtils::RangeReader>(const std::string&)> ReaderFactory;
+
+    // a HEIF Exif item or a moov box beyond this isn't worth reading
+    static const size_t METADATA_LIMIT = 16 * 1024 * 1024;
+
+    // a local file per input when openReader is empty; the header and
+    // metadata buffers of the scan are charged to budget
+    LivePhotoIndex(unsigned int jobs, MemoryBudget& budget, const ReaderFactory& openReader);
+
+    // inputs are relative to root when one is set
+    void setRoot(const std::string& root);
+    void scan(const std::vector<std::string>& inputs);
+
+    // stills in input order with their movie, paths as given to scan()
+    const std::vector<LivePhotoPair>& pairs() const;
+    uint64_t unpairedStills() const;
+    uint64_t unpairedMovies() const;
+    uint64_t readRequests() const;
+
+    static bool isStill(const std::string& path);
+    static bool isMovie(const std::string& path);
+    // empty when the file has none
+    static std::string stillIdentifier(HeifUtils::RangeReader& reader, bool heic, MemoryBudget& budget);
+    static std::string movieIdentifier(HeifUtils::RangeReader& reader, MemoryBudget& budget);
+
+private:
+    unsigned int                m_jobs;
+    MemoryBudget&               m_budget;
+    ReaderFactory               m_openReader;
+    std::string                 m_root;
+    std::vector<LivePhotoPair>  m_pairs;
+    uint64_t                    m_unpairedStills;
+    uint64_t                    m_unpairedMovies;
+    uint64_t                    m_readRequests;
+};
+
+#endif // LIVEPHOTO_H
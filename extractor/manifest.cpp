@@ -0,0 +1,93 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "manifest.h"
+
+#include <sstream>
+#include <stdio.h>
+
+Manifest::Manifest(const std::string& path)
+    : m_file(path.c_str(), std::ios::app)
+{
+}
+
+bool Manifest::isOpen() const
+{
+    return m_file.is_open();
+}
+
+std::string Manifest::jsonEscape(const std::string& str)
+{
+    std::string res;
+    res.reserve(str.size() + 2);
+    for (unsigned char c : str)
+    {
+        switch (c)
+        {
+        case '"':
+            res += "\\\"";
+            break;
+        case '\\':
+            res += "\\\\";
+            break;
+        case '\n':
+            res += "\\n";
+            break;
+        case '\r':
+            res += "\\r";
+            break;
+        case '\t':
+            res += "\\t";
+            break;
+        default:
+            if (c < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                res += buf;
+            }
+            else
+            {
+                res.push_back(static_cast<char>(c));
+            }
+        }
+    }
+    return res;
+}
+
+std::string Manifest::format(const ExtractorHelpers::ManifestRecord& record)
+{
+    std::ostringstream line;
+    line << "{\"source\":\"" << jsonEscape(record.payload.sourcePath) << '"'
+         << ",\"output\":\"" << jsonEscape(record.output.location) << '"'
+         << ",\"offset\":" << record.output.offset
+         << ",\"size\":" << record.payload.size
+         << ",\"xxh64\":\"" << record.payload.xxh64 << '"';
+    if (!record.payload.sha256.empty())
+    {
+        line << ",\"sha256\":\"" << record.payload.sha256 << '"';
+    }
+    line << ",\"duplicate\":" << (record.duplicate ? "true" : "false");
+    std::string metadata = MediaMetadataHelpers::jsonFields(record.metadata);
+    if (!metadata.empty())
+    {
+        line << ",\"metadata\":{" << metadata << '}';
+    }
+    line << '}';
+    return line.str();
+}
+
+bool Manifest::add(const ExtractorHelpers::ManifestRecord& record)
+{
+    std::string line = format(record) + "\n";
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_file << line;
+    m_file.flush();
+    if (!m_file)
+    {
+        // a later line must not land after a torn one
+        m_file.close();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <outputsink.h>
+#include <metadata.h>
+
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace ExtractorHelpers
+{
+    struct ManifestRecord
+    {
+        PayloadInfo payload;
+        OutputRef   output;
+        bool        duplicate = false;
+        // filled when metadata was requested
+        MediaMetadata metadata;
+    };
+}
+
+// One JSON object per line for every extracted video, so consumers get
+// the digests without reading the videos again.
+class Manifest
+{
+public:
+    Manifest(const std::string& path);
+
+    bool isOpen() const;
+    // false when the line didn't reach the file
+    bool add(const ExtractorHelpers::ManifestRecord& record);
+
+    // the record as one JSON object, also what a sidecar file holds
+    static std::string format(const ExtractorHelpers::ManifestRecord& record);
+    static std::string jsonEscape(const std::string& str);
+
+private:
+    std::mutex      m_mutex;
+    std::ofstream   m_file;
+};
+
+#endif // MANIFEST_H
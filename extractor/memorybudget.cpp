@@ -0,0 +1,221 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "memorybudget.h"
+
+MemoryBudget::MemoryBudget(uint64_t limit)
+    : m_limit(limit)
+    , m_inUse(0)
+    , m_charged(0)
+    , m_reserved(0)
+    , m_nextTicket(0)
+    , m_servingTicket(0)
+{
+}
+
+void MemoryBudget::acquire(uint64_t bytes)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t ticket = m_nextTicket++;
+    m_cond.wait(lock, [&]() {
+        return ticket == m_servingTicket
+            && (m_limit == 0 || m_inUse == 0 || m_reserved + m_inUse + m_charged + bytes <= m_limit);
+    });
+    m_inUse += bytes;
+    ++m_servingTicket;
+    m_cond.notify_all();
+}
+
+void MemoryBudget::release(uint64_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_inUse -= bytes;
+    }
+    m_cond.notify_all();
+}
+
+void MemoryBudget::charge(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_charged += bytes;
+}
+
+void MemoryBudget::discharge(uint64_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_charged -= bytes;
+    }
+    m_cond.notify_all();
+}
+
+void MemoryBudget::reserve(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_reserved += bytes;
+}
+
+uint64_t MemoryBudget::limit() const
+{
+    return m_limit;
+}
+
+uint64_t MemoryBudget::inUse()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_inUse + m_charged + m_reserved;
+}
+
+BudgetGuard::BudgetGuard(MemoryBudget& budget, uint64_t bytes, bool wait)
+    : m_budget(budget)
+    , m_bytes(bytes)
+    , m_wait(wait)
+{
+    if (m_bytes && m_wait)
+    {
+        m_budget.acquire(m_bytes);
+    }
+    else if (m_bytes)
+    {
+        m_budget.charge(m_bytes);
+    }
+}
+
+BudgetGuard::~BudgetGuard()
+{
+    release();
+}
+
+void BudgetGuard::release()
+{
+    if (m_bytes && m_wait)
+    {
+        m_budget.release(m_bytes);
+    }
+    else if (m_bytes)
+    {
+        m_budget.discharge(m_bytes);
+    }
+    m_bytes = 0;
+}
+
+BufferPool::Lease::Lease()
+    : m_pool(nullptr)
+    , m_size(0)
+    , m_pooled(false)
+{
+}
+
+BufferPool::Lease::Lease(Lease&& other)
+    : m_pool(other.m_pool)
+    , m_buffer(std::move(other.m_buffer))
+    , m_size(other.m_size)
+    , m_pooled(other.m_pooled)
+{
+    other.m_pool = nullptr;
+    other.m_size = 0;
+}
+
+BufferPool::Lease& BufferPool::Lease::operator=(Lease&& other)
+{
+    if (this != &other)
+    {
+        reset();
+        m_pool = other.m_pool;
+        m_buffer = std::move(other.m_buffer);
+        m_size = other.m_size;
+        m_pooled = other.m_pooled;
+        other.m_pool = nullptr;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+BufferPool::Lease::~Lease()
+{
+    reset();
+}
+
+void BufferPool::Lease::reset()
+{
+    if (m_pool)
+    {
+        m_pool->giveBack(*this);
+        m_pool = nullptr;
+    }
+    m_size = 0;
+}
+
+uint8_t* BufferPool::Lease::data()
+{
+    return m_buffer.data();
+}
+
+size_t BufferPool::Lease::size() const
+{
+    return m_size;
+}
+
+BufferPool::BufferPool(MemoryBudget& budget, size_t bufferSize, size_t maxBuffers)
+    : m_budget(budget)
+    , m_bufferSize(bufferSize)
+    , m_allocated(0)
+    , m_maxBuffers(maxBuffers)
+{
+    m_budget.reserve(static_cast<uint64_t>(bufferSize) * maxBuffers);
+}
+
+BufferPool::Lease BufferPool::lease(size_t size)
+{
+    Lease res;
+    res.m_pool = this;
+    res.m_size = size;
+
+    if (size <= m_bufferSize)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&]() { return !m_free.empty() || m_allocated < m_maxBuffers; });
+        if (!m_free.empty())
+        {
+            res.m_buffer = std::move(m_free.back());
+            m_free.pop_back();
+        }
+        else
+        {
+            res.m_buffer.reserve(m_bufferSize);
+            ++m_allocated;
+        }
+        res.m_pooled = true;
+        lock.unlock();
+        // within capacity, so no reallocation
+        res.m_buffer.resize(size);
+        return res;
+    }
+
+    m_budget.acquire(size);
+    res.m_pooled = false;
+    res.m_buffer.resize(size);
+    return res;
+}
+
+MemoryBudget& BufferPool::budget()
+{
+    return m_budget;
+}
+
+void BufferPool::giveBack(Lease& lease)
+{
+    if (lease.m_pooled)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_free.emplace_back(std::move(lease.m_buffer));
+        }
+        m_cond.notify_one();
+    }
+    else
+    {
+        std::vector<uint8_t>().swap(lease.m_buffer);
+        m_budget.release(lease.m_size);
+    }
+}
@@ -0,0 +1,113 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// Byte budget shared by all extraction workers. Requests are admitted in
+// arrival order, so a large video can't be starved by a stream of small
+// ones; a request bigger than the whole budget is admitted once nothing
+// else is in flight. Parse buffers (probes, headers) are charged instead:
+// a worker keeps them while it waits for its video, so they count against
+// what is admitted but never wait themselves, which would deadlock two
+// workers each holding headers and waiting for the other's bytes.
+class MemoryBudget
+{
+public:
+    // limit 0 means unlimited
+    MemoryBudget(uint64_t limit);
+
+    void acquire(uint64_t bytes);
+    void release(uint64_t bytes);
+    // counted at once, see above
+    void charge(uint64_t bytes);
+    void discharge(uint64_t bytes);
+    // permanently set aside, e.g. for pooled buffers
+    void reserve(uint64_t bytes);
+
+    uint64_t limit() const;
+    uint64_t inUse();
+
+private:
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    uint64_t                m_limit;
+    uint64_t                m_inUse;
+    uint64_t                m_charged;
+    uint64_t                m_reserved;
+    uint64_t                m_nextTicket;
+    uint64_t                m_servingTicket;
+};
+
+// holds part of the budget for the lifetime of a scope
+class BudgetGuard
+{
+public:
+    // charges the bytes rather than waiting for them unless wait is set
+    BudgetGuard(MemoryBudget& budget, uint64_t bytes, bool wait = true);
+    ~BudgetGuard();
+
+    // gives the bytes back before the scope ends
+    void release();
+
+private:
+    BudgetGuard(const BudgetGuard&) = delete;
+    BudgetGuard& operator=(const BudgetGuard&) = delete;
+
+    MemoryBudget&   m_budget;
+    uint64_t        m_bytes;
+    bool            m_wait;
+};
+
+// Fixed-size buffers reused between files. Payloads that fit are served
+// from the pool, larger ones get a dedicated allocation charged against
+// the budget for as long as the lease lives.
+class BufferPool
+{
+public:
+    static const size_t DEFAULT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    class Lease
+    {
+    public:
+        Lease();
+        Lease(Lease&& other);
+        Lease& operator=(Lease&& other);
+        ~Lease();
+
+        uint8_t* data();
+        size_t size() const;
+
+    private:
+        friend class BufferPool;
+        void reset();
+
+        BufferPool*             m_pool;
+        std::vector<uint8_t>    m_buffer;
+        size_t                  m_size;
+        bool                    m_pooled;
+    };
+
+    BufferPool(MemoryBudget& budget, size_t bufferSize, size_t maxBuffers);
+
+    // blocks until the budget admits the request
+    Lease lease(size_t size);
+    MemoryBudget& budget();
+
+private:
+    void giveBack(Lease& lease);
+
+    MemoryBudget&                       m_budget;
+    size_t                              m_bufferSize;
+    std::mutex                          m_mutex;
+    std::condition_variable             m_cond;
+    std::vector<std::vector<uint8_t>>   m_free;
+    size_t                              m_allocated;
+    size_t                              m_maxBuffers;
+};
+
+#endif // MEMORYBUDGET_H
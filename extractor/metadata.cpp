@@ -0,0 +1,168 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "metadata.h"
+#include "manifest.h"
+
+#include <TinyEXIF.h>
+
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+namespace
+{
+    // days since 1970-01-01 to a proleptic Gregorian date, no time zone
+    // database or thread-unsafe gmtime() involved
+    void civil_from_days(int64_t days, int64_t& year, unsigned& month, unsigned& day)
+    {
+        days += 719468;
+        const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+        const unsigned doe = static_cast<unsigned>(days - era * 146097);
+        const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        const unsigned mp = (5 * doy + 2) / 153;
+        day = doy - (153 * mp + 2) / 5 + 1;
+        month = mp < 10 ? mp + 3 : mp - 9;
+        year = static_cast<int64_t>(yoe) + era * 400 + (month <= 2 ? 1 : 0);
+    }
+}
+
+namespace MediaMetadataHelpers
+{
+    bool setUtcMilliseconds(const std::string& value, ExtractorHelpers::MediaMetadata& metadata)
+    {
+        // the SEF field keeps its terminator and may carry padding behind it
+        uint64_t ms = 0;
+        size_t digits = 0;
+        while (digits < value.size() && value[digits] >= '0' && value[digits] <= '9' && digits < 15)
+        {
+            ms = ms * 10 + static_cast<uint64_t>(value[digits] - '0');
+            ++digits;
+        }
+        if (digits == 0)
+        {
+            return false;
+        }
+
+        const uint64_t seconds = ms / 1000;
+        int64_t year = 0;
+        unsigned month = 0;
+        unsigned day = 0;
+        civil_from_days(static_cast<int64_t>(seconds / 86400), year, month, day);
+        const unsigned secOfDay = static_cast<unsigned>(seconds % 86400);
+
+        char buf[48];
+        snprintf(buf, sizeof(buf), "%04lld-%02u-%02uT%02u:%02u:%02u.%03uZ",
+                 static_cast<long long>(year), month, day,
+                 secOfDay / 3600, (secOfDay / 60) % 60, secOfDay % 60,
+                 static_cast<unsigned>(ms % 1000));
+        metadata.captureTime = buf;
+        return true;
+    }
+
+    void setFromExif(const TinyEXIF::EXIFInfo& exif, ExtractorHelpers::MediaMetadata& metadata)
+    {
+        // "YYYY:MM:DD HH:MM:SS" in camera local time
+        const std::string& dt = exif.DateTimeOriginal.empty() ? exif.DateTime : exif.DateTimeOriginal;
+        if (metadata.captureTimeLocal.empty() && dt.size() >= 19 && dt.compare(0, 4, "0000") != 0)
+        {
+            std::string iso = dt.substr(0, 19);
+            iso[4] = '-';
+            iso[7] = '-';
+            iso[10] = 'T';
+            metadata.captureTimeLocal = iso;
+        }
+
+        if (exif.GeoLocation.hasLatLon())
+        {
+            metadata.hasLocation = true;
+            metadata.latitude = exif.GeoLocation.Latitude;
+            metadata.longitude = exif.GeoLocation.Longitude;
+            if (exif.GeoLocation.hasAltitude())
+            {
+                metadata.hasAltitude = true;
+                metadata.altitude = exif.GeoLocation.Altitude;
+            }
+        }
+    }
+
+    bool setFromExifItem(const uint8_t* data, size_t size, ExtractorHelpers::MediaMetadata& metadata)
+    {
+        static const char EXIF_HEADER[] = "Exif\0\0";
+        static const size_t EXIF_HEADER_SIZE = 6;
+        if (size < 4)
+        {
+            return false;
+        }
+        const uint64_t tiffOffset = 4 + ((static_cast<uint64_t>(data[0]) << 24)
+            | (static_cast<uint64_t>(data[1]) << 16)
+            | (static_cast<uint64_t>(data[2]) << 8)
+            | data[3]);
+        if (tiffOffset >= size)
+        {
+            return false;
+        }
+
+        TinyEXIF::EXIFInfo exif;
+        int res = TinyEXIF::PARSE_INVALID_JPEG;
+        if (tiffOffset >= 4 + EXIF_HEADER_SIZE
+            && memcmp(data + tiffOffset - EXIF_HEADER_SIZE, EXIF_HEADER, EXIF_HEADER_SIZE) == 0)
+        {
+            const uint8_t* segment = data + tiffOffset - EXIF_HEADER_SIZE;
+            res = exif.parseFromEXIFSegment(segment, static_cast<unsigned>(size - (segment - data)));
+        }
+        else
+        {
+            // bare TIFF, the parser wants the APP1 identifier in front
+            std::vector<uint8_t> segment(EXIF_HEADER, EXIF_HEADER + EXIF_HEADER_SIZE);
+            segment.insert(segment.end(), data + tiffOffset, data + size);
+            res = exif.parseFromEXIFSegment(segment.data(), static_cast<unsigned>(segment.size()));
+        }
+        if (res != TinyEXIF::PARSE_SUCCESS)
+        {
+            return false;
+        }
+        setFromExif(exif, metadata);
+        return true;
+    }
+
+    std::string jsonFields(const ExtractorHelpers::MediaMetadata& metadata)
+    {
+        std::ostringstream fields;
+        fields << std::setprecision(10);
+        const char* sep = "";
+        if (!metadata.captureTime.empty())
+        {
+            fields << sep << "\"capture_time\":\"" << Manifest::jsonEscape(metadata.captureTime) << '"';
+            sep = ",";
+        }
+        if (!metadata.captureTimeLocal.empty())
+        {
+            fields << sep << "\"capture_time_local\":\"" << Manifest::jsonEscape(metadata.captureTimeLocal) << '"';
+            sep = ",";
+        }
+        if (metadata.hasLocation)
+        {
+            fields << sep << "\"latitude\":" << metadata.latitude
+                   << ",\"longitude\":" << metadata.longitude;
+            if (metadata.hasAltitude)
+            {
+                fields << ",\"altitude\":" << metadata.altitude;
+            }
+            sep = ",";
+        }
+        if (metadata.hasVideoInfo && metadata.video.timescale)
+        {
+            fields << sep << "\"duration\":"
+                   << static_cast<double>(metadata.video.duration) / metadata.video.timescale;
+            sep = ",";
+        }
+        if (metadata.hasVideoInfo && !metadata.video.videoCodec.empty())
+        {
+            fields << sep << "\"codec\":\"" << Manifest::jsonEscape(metadata.video.videoCodec) << '"';
+        }
+        return fields.str();
+    }
+}
@@ -0,0 +1,49 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef METADATA_H
+#define METADATA_H
+
+#include <isobmff.h>
+
+#include <stdint.h>
+#include <string>
+
+namespace TinyEXIF
+{
+    class EXIFInfo;
+}
+
+namespace ExtractorHelpers
+{
+    // What a photo library wants next to the clip, gathered from the
+    // headers the extractor parses anyway.
+    struct MediaMetadata
+    {
+        // ISO 8601 UTC with a "Z" suffix, only when the camera recorded UTC
+        std::string captureTime;
+        // ISO 8601 camera local time from EXIF, the zone isn't recorded
+        std::string captureTimeLocal;
+        bool        hasLocation = false;
+        double      latitude = 0.0;
+        double      longitude = 0.0;
+        bool        hasAltitude = false;
+        double      altitude = 0.0;
+        bool        hasVideoInfo = false;
+        Mp4Info     video;
+    };
+}
+
+namespace MediaMetadataHelpers
+{
+    // Samsung Image_UTC_Data: milliseconds since the epoch as text
+    bool setUtcMilliseconds(const std::string& value, ExtractorHelpers::MediaMetadata& metadata);
+    // DateTimeOriginal as the local capture time, and GPS
+    void setFromExif(const TinyEXIF::EXIFInfo& exif, ExtractorHelpers::MediaMetadata& metadata);
+    // the HEIF Exif item: tiff header offset, then the Exif segment
+    bool setFromExifItem(const uint8_t* data, size_t size, ExtractorHelpers::MediaMetadata& metadata);
+
+    // JSON members without braces, empty when nothing is known
+    std::string jsonFields(const ExtractorHelpers::MediaMetadata& metadata);
+}
+
+#endif // METADATA_H
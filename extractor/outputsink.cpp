@@ -0,0 +1,707 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "outputsink.h"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <string.h>
+
+namespace
+{
+    const size_t TAR_BLOCK_SIZE = 512;
+
+    void writeOctal(char* field, size_t fieldSize, uint64_t value)
+    {
+        // fieldSize - 1 digits followed by NUL
+        field[fieldSize - 1] = '\0';
+        for (size_t i = fieldSize - 1; i > 0; --i)
+        {
+            field[i - 1] = static_cast<char>('0' + (value & 7));
+            value >>= 3;
+        }
+    }
+
+    size_t tarPadding(uint64_t size)
+    {
+        return static_cast<size_t>((TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+    }
+
+    void fillTarHeader(uint8_t* header, const std::string& entryName, uint64_t size, char typeflag)
+    {
+        memset(header, 0, TAR_BLOCK_SIZE);
+        char* h = reinterpret_cast<char*>(header);
+
+        std::string name = entryName.substr(0, 99);
+        memcpy(h, name.data(), name.size());         // name
+        writeOctal(h + 100, 8, 0644);                 // mode
+        writeOctal(h + 108, 8, 0);                    // uid
+        writeOctal(h + 116, 8, 0);                    // gid
+        writeOctal(h + 124, 12, size);                // size
+        writeOctal(h + 136, 12, static_cast<uint64_t>(time(nullptr))); // mtime
+        memset(h + 148, ' ', 8);                      // chksum, spaces while summing
+        h[156] = typeflag;                            // '0' regular file, 'x' pax header
+        memcpy(h + 257, "ustar", 6);                  // magic
+        memcpy(h + 263, "00", 2);                     // version
+
+        unsigned int checksum = 0;
+        for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i)
+        {
+            checksum += header[i];
+        }
+        writeOctal(h + 148, 7, checksum);
+        h[155] = ' ';
+    }
+
+    // Header blocks in front of a member's data. The ustar name field holds
+    // 99 bytes, a longer name goes in a pax extended header before it,
+    // which readers take over the truncated ustar name.
+    std::vector<uint8_t> tarHeaders(const std::string& entryName, uint64_t size)
+    {
+        std::vector<uint8_t> headers;
+        if (entryName.size() > 99)
+        {
+            // "<length> path=<name>\n", the length counts its own digits
+            const std::string field = " path=" + entryName + "\n";
+            size_t length = field.size() + 1;
+            while (std::to_string(length).size() + field.size() != length)
+            {
+                length = std::to_string(length).size() + field.size();
+            }
+            const std::string record = std::to_string(length) + field;
+            headers.resize(TAR_BLOCK_SIZE + record.size() + tarPadding(record.size()));
+            fillTarHeader(&headers[0], "PaxHeader", record.size(), 'x');
+            memcpy(&headers[TAR_BLOCK_SIZE], record.data(), record.size());
+        }
+        const size_t memberHeader = headers.size();
+        headers.resize(memberHeader + TAR_BLOCK_SIZE);
+        fillTarHeader(&headers[memberHeader], entryName, size, '0');
+        return headers;
+    }
+
+    // tabs and line breaks in a path would split the index line
+    std::string escape_index_field(const std::string& field)
+    {
+        std::string res;
+        res.reserve(field.size());
+        for (char c : field)
+        {
+            switch (c)
+            {
+            case '\\':
+                res += "\\\\";
+                break;
+            case '\t':
+                res += "\\t";
+                break;
+            case '\n':
+                res += "\\n";
+                break;
+            case '\r':
+                res += "\\r";
+                break;
+            default:
+                res += c;
+                break;
+            }
+        }
+        return res;
+    }
+
+    // Page cache bypass needs aligned memory, lengths and offsets; the
+    // pieces handed to a stream are neither, so they are staged here and
+    // go out in whole buffers, the unaligned tail through the cache.
+    const size_t DIRECT_BUFFER_SIZE = 1024 * 1024;
+
+    class FileOutputStream : public OutputStream
+    {
+    public:
+        FileOutputStream(const std::string& path, const ExtractorHelpers::OutputPolicy& policy)
+            : m_path(path)
+            , m_writePath(policy.atomicRename ? path + ".part" : path)
+            , m_policy(policy)
+            , m_direct(false)
+            , m_aligned(nullptr)
+            , m_staged(0)
+        {
+        }
+
+        bool open(uint64_t size)
+        {
+            if (!m_file.open(m_writePath, PlatformFile::OpenMode::WRITE_TRUNCATE))
+            {
+                return false;
+            }
+            if (m_policy.preallocate && size)
+            {
+                m_file.preallocate(size);
+            }
+            if (m_policy.directMinSize && size >= m_policy.directMinSize && m_file.setDirect(true))
+            {
+                m_direct = true;
+                m_staging.resize(DIRECT_BUFFER_SIZE + PlatformFile::DIRECT_ALIGNMENT);
+                uintptr_t base = reinterpret_cast<uintptr_t>(m_staging.data());
+                size_t shift = (PlatformFile::DIRECT_ALIGNMENT - base % PlatformFile::DIRECT_ALIGNMENT) % PlatformFile::DIRECT_ALIGNMENT;
+                m_aligned = m_staging.data() + shift;
+            }
+            return true;
+        }
+
+        bool write(const uint8_t* data, size_t len) override
+        {
+            if (!m_direct)
+            {
+                return m_file.writeAll(data, len);
+            }
+            while (len)
+            {
+                size_t chunk = DIRECT_BUFFER_SIZE - m_staged;
+                if (chunk > len)
+                {
+                    chunk = len;
+                }
+                memcpy(m_aligned + m_staged, data, chunk);
+                m_staged += chunk;
+                data += chunk;
+                len -= chunk;
+                if (m_staged == DIRECT_BUFFER_SIZE)
+                {
+                    if (!m_file.writeAll(m_aligned, m_staged))
+                    {
+                        return false;
+                    }
+                    m_staged = 0;
+                }
+            }
+            return true;
+        }
+
+        bool copyFrom(PlatformFile& input, uint64_t offset, uint64_t len, uint64_t& copied) override
+        {
+            if (m_direct)
+            {
+                // a kernel copy would go through the page cache after all
+                copied = 0;
+                return false;
+            }
+            return m_file.copyFrom(input, offset, len, copied);
+        }
+
+        ExtractorHelpers::SinkResult finish(const ExtractorHelpers::PayloadInfo&, ExtractorHelpers::OutputRef& ref) override
+        {
+            if (m_direct && m_staged)
+            {
+                size_t whole = m_staged - m_staged % PlatformFile::DIRECT_ALIGNMENT;
+                if ((whole && !m_file.writeAll(m_aligned, whole))
+                    || !m_file.setDirect(false)
+                    || !m_file.writeAll(m_aligned + whole, m_staged - whole))
+                {
+                    abort();
+                    return ExtractorHelpers::SinkResult::WRITE_ERROR;
+                }
+            }
+            // the data goes down before the name, or a crash could leave
+            // the final name on an empty file
+            if (m_writePath != m_path && !m_file.sync())
+            {
+                abort();
+                return ExtractorHelpers::SinkResult::WRITE_ERROR;
+            }
+            m_file.close();
+            if (m_writePath != m_path && !PlatformFile::rename(m_writePath, m_path))
+            {
+                PlatformFile::remove(m_writePath);
+                return ExtractorHelpers::SinkResult::WRITE_ERROR;
+            }
+            ref.location = m_path;
+            ref.offset = 0;
+            // a failed sync may have lost this file along with its group
+            if (m_policy.sync && !m_policy.sync->fileDone(m_path))
+            {
+                return ExtractorHelpers::SinkResult::WRITE_ERROR;
+            }
+            return ExtractorHelpers::SinkResult::Ok;
+        }
+
+        void abort() override
+        {
+            m_file.close();
+            PlatformFile::remove(m_writePath);
+        }
+
+    private:
+        std::string                     m_path;
+        std::string                     m_writePath;
+        ExtractorHelpers::OutputPolicy  m_policy;
+        PlatformFile                    m_file;
+        bool                            m_direct;
+        std::vector<uint8_t>            m_staging;
+        uint8_t*                        m_aligned;
+        size_t                          m_staged;
+    };
+
+    std::unique_ptr<OutputStream> open_file_stream(const std::string& path, const ExtractorHelpers::OutputPolicy& policy,
+                                                   uint64_t size)
+    {
+        std::unique_ptr<FileOutputStream> stream(new FileOutputStream(path, policy));
+        if (!stream->open(size))
+        {
+            return nullptr;
+        }
+        return std::move(stream);
+    }
+
+    ExtractorHelpers::SinkResult write_file(const std::string& path, const ExtractorHelpers::OutputPolicy& policy,
+                                            const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                            ExtractorHelpers::OutputRef& ref)
+    {
+        std::unique_ptr<OutputStream> stream = open_file_stream(path, policy, info.size);
+        if (!stream)
+        {
+            return ExtractorHelpers::SinkResult::OPEN_ERROR;
+        }
+        if (!stream->write(data, static_cast<size_t>(info.size)))
+        {
+            stream->abort();
+            return ExtractorHelpers::SinkResult::WRITE_ERROR;
+        }
+        return stream->finish(info, ref);
+    }
+
+    ExtractorHelpers::SinkResult write_text_file(const std::string& path, const ExtractorHelpers::OutputPolicy& policy,
+                                                 const std::string& text)
+    {
+        // sidecars are small, only their durability follows the policy
+        ExtractorHelpers::OutputPolicy textPolicy = policy;
+        textPolicy.preallocate = false;
+        textPolicy.directMinSize = 0;
+        ExtractorHelpers::PayloadInfo info;
+        info.size = text.size();
+        ExtractorHelpers::OutputRef ref;
+        return write_file(path, textPolicy, info, reinterpret_cast<const uint8_t*>(text.data()), ref);
+    }
+}
+
+bool OutputSink::claimName(const std::string& name, const std::string& sourcePath)
+{
+    std::lock_guard<std::mutex> guard(m_namesMutex);
+    return m_names.insert(std::make_pair(name, sourcePath)).first->second == sourcePath;
+}
+
+std::string OutputSink::sidecarPath(const std::string& location)
+{
+    size_t slash = location.find_last_of("/\\");
+    size_t dot = location.find_last_of('.');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+    {
+        return location.substr(0, dot) + ".json";
+    }
+    return location + ".json";
+}
+
+FileSink::FileSink(const std::string& outputPath, const ExtractorHelpers::OutputPolicy& policy)
+    : m_outputPath(outputPath)
+    , m_policy(policy)
+{
+}
+
+ExtractorHelpers::SinkResult FileSink::write(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                             ExtractorHelpers::OutputRef& ref)
+{
+    return write_file(m_outputPath, m_policy, info, data, ref);
+}
+
+ExtractorHelpers::SinkResult FileSink::writeSidecar(const ExtractorHelpers::OutputRef& ref, const std::string& json)
+{
+    return write_text_file(sidecarPath(ref.location), m_policy, json);
+}
+
+std::unique_ptr<OutputStream> FileSink::openStream(const ExtractorHelpers::PayloadInfo& info)
+{
+    return open_file_stream(m_outputPath, m_policy, info.size);
+}
+
+void FileSink::whenDurable(const std::function<void(bool)>& action)
+{
+    if (m_policy.sync)
+    {
+        m_policy.sync->whenSynced(action);
+    }
+    else
+    {
+        action(true);
+    }
+}
+
+bool FileSink::flush()
+{
+    return !m_policy.sync || m_policy.sync->flush();
+}
+
+DirectorySink::DirectorySink(const std::string& outputDir, const ExtractorHelpers::OutputPolicy& policy)
+    : m_outputDir(outputDir)
+    , m_policy(policy)
+{
+    if (!m_outputDir.empty() && m_outputDir.back() != '/' && m_outputDir.back() != '\\')
+    {
+        m_outputDir += '/';
+    }
+}
+
+ExtractorHelpers::SinkResult DirectorySink::write(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                                  ExtractorHelpers::OutputRef& ref)
+{
+    ExtractorHelpers::SinkResult result = prepare(info);
+    if (result != ExtractorHelpers::SinkResult::Ok)
+    {
+        return result;
+    }
+    return write_file(m_outputDir + info.entryName, m_policy, info, data, ref);
+}
+
+ExtractorHelpers::SinkResult DirectorySink::prepare(const ExtractorHelpers::PayloadInfo& info)
+{
+    if (!claimName(info.entryName, info.sourcePath))
+    {
+        return ExtractorHelpers::SinkResult::NAME_TAKEN;
+    }
+    size_t slash = info.entryName.find_last_of('/');
+    if (slash != std::string::npos && !PlatformFile::createDirectories(m_outputDir + info.entryName.substr(0, slash)))
+    {
+        return ExtractorHelpers::SinkResult::OPEN_ERROR;
+    }
+    return ExtractorHelpers::SinkResult::Ok;
+}
+
+ExtractorHelpers::SinkResult DirectorySink::writeDuplicate(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                                           const ExtractorHelpers::OutputRef& original,
+                                                           ExtractorHelpers::OutputRef& ref)
+{
+    std::string path = m_outputDir + info.entryName;
+    if (path == original.location)
+    {
+        ref = original;
+        return ExtractorHelpers::SinkResult::Ok;
+    }
+    ExtractorHelpers::SinkResult result = prepare(info);
+    if (result != ExtractorHelpers::SinkResult::Ok)
+    {
+        return result;
+    }
+    if (PlatformFile::hardLink(original.location, path))
+    {
+        ref.location = path;
+        ref.offset = 0;
+        return ExtractorHelpers::SinkResult::Ok;
+    }
+    // e.g. the file system has no hard links
+    return write_file(path, m_policy, info, data, ref);
+}
+
+ExtractorHelpers::SinkResult DirectorySink::writeSidecar(const ExtractorHelpers::OutputRef& ref, const std::string& json)
+{
+    return write_text_file(sidecarPath(ref.location), m_policy, json);
+}
+
+std::unique_ptr<OutputStream> DirectorySink::openStream(const ExtractorHelpers::PayloadInfo& info)
+{
+    // write() runs into the same refusal and reports it
+    if (prepare(info) != ExtractorHelpers::SinkResult::Ok)
+    {
+        return nullptr;
+    }
+    return open_file_stream(m_outputDir + info.entryName, m_policy, info.size);
+}
+
+void DirectorySink::whenDurable(const std::function<void(bool)>& action)
+{
+    if (m_policy.sync)
+    {
+        m_policy.sync->whenSynced(action);
+    }
+    else
+    {
+        action(true);
+    }
+}
+
+bool DirectorySink::flush()
+{
+    return !m_policy.sync || m_policy.sync->flush();
+}
+
+PackSink::PackSink(const std::string& packPath)
+    : m_packPath(packPath)
+    , m_indexRead(0)
+    , m_committedEnd(0)
+    , m_inBatch(false)
+    , m_failed(false)
+    , m_batchStart(0)
+    , m_end(0)
+    , m_batchMembers(0)
+{
+}
+
+PackSink::~PackSink()
+{
+    flush();
+}
+
+bool PackSink::open()
+{
+    PlatformFile existing;
+    if (!existing.open(indexPath(m_packPath), PlatformFile::OpenMode::READ_ONLY)
+        && existing.open(m_packPath, PlatformFile::OpenMode::READ_ONLY) && existing.size() != 0)
+    {
+        return false;
+    }
+    // the index is there before any member is
+    return m_index.open(indexPath(m_packPath), PlatformFile::OpenMode::READ_WRITE)
+        && m_pack.open(m_packPath, PlatformFile::OpenMode::READ_WRITE);
+}
+
+std::string PackSink::indexPath(const std::string& packPath)
+{
+    return packPath + ".idx";
+}
+
+bool PackSink::beginBatch()
+{
+    if (!m_pack.lockExclusive())
+    {
+        return false;
+    }
+    if (!recover())
+    {
+        m_pack.unlock();
+        return false;
+    }
+    m_inBatch = true;
+    m_batchStart = m_end;
+    m_batchMembers = 0;
+    return true;
+}
+
+bool PackSink::commitBatch()
+{
+    static const uint8_t endOfArchive[2 * TAR_BLOCK_SIZE] = {};
+    // the members are on disk before any index line names them
+    if (!m_pack.writeAll(m_buffer.data(), m_buffer.size())
+        || !m_pack.writeAll(endOfArchive, sizeof(endOfArchive))
+        || !m_pack.sync()
+        || !m_index.writeAll(reinterpret_cast<const uint8_t*>(m_indexLines.data()), m_indexLines.size())
+        || !m_index.sync())
+    {
+        failBatch();
+        return false;
+    }
+    m_indexRead += m_indexLines.size();
+    m_committedEnd = m_end;
+    m_buffer.clear();
+    m_indexLines.clear();
+    m_pack.unlock();
+    m_inBatch = false;
+
+    for (const auto& action : m_actions)
+    {
+        action(true);
+    }
+    m_actions.clear();
+    return true;
+}
+
+void PackSink::failBatch()
+{
+    m_failed = true;
+    m_buffer.clear();
+    m_indexLines.clear();
+    m_pack.unlock();
+    m_inBatch = false;
+
+    for (const auto& action : m_actions)
+    {
+        action(false);
+    }
+    m_actions.clear();
+}
+
+bool PackSink::recover()
+{
+    const int64_t indexSize = m_index.size();
+    if (indexSize < 0)
+    {
+        return false;
+    }
+    if (static_cast<uint64_t>(indexSize) < m_indexRead)
+    {
+        // replaced under us, start over
+        m_indexRead = 0;
+        m_committedEnd = 0;
+    }
+
+    // only the lines other processes appended since our last batch
+    std::string text(static_cast<size_t>(indexSize - m_indexRead), '\0');
+    if (!text.empty())
+    {
+        std::ifstream in(indexPath(m_packPath).c_str(), std::ios::binary);
+        in.seekg(static_cast<std::streamoff>(m_indexRead));
+        if (!in.read(&text[0], static_cast<std::streamsize>(text.size())))
+        {
+            return false;
+        }
+    }
+    size_t lineStart = 0;
+    for (size_t lineEnd = text.find('\n'); lineEnd != std::string::npos; lineEnd = text.find('\n', lineStart))
+    {
+        // source, payload offset, length, ...; the source is escaped, so tabs only separate
+        const size_t offsetStart = text.find('\t', lineStart);
+        const size_t lengthStart = offsetStart < lineEnd ? text.find('\t', offsetStart + 1) : std::string::npos;
+        if (lengthStart < lineEnd)
+        {
+            const uint64_t offset = std::strtoull(text.c_str() + offsetStart + 1, nullptr, 10);
+            const uint64_t length = std::strtoull(text.c_str() + lengthStart + 1, nullptr, 10);
+            m_committedEnd = std::max(m_committedEnd, offset + length + tarPadding(length));
+        }
+        lineStart = lineEnd + 1;
+    }
+    m_indexRead += lineStart;
+
+    // also cuts the line a writer died inside
+    const int64_t packSize = m_pack.size();
+    if (!m_index.truncate(m_indexRead) || packSize < 0)
+    {
+        return false;
+    }
+    m_end = std::min(static_cast<uint64_t>(packSize), m_committedEnd);
+    return m_pack.truncate(m_end);
+}
+
+bool PackSink::appendPack(const uint8_t* data, size_t len)
+{
+    if (m_buffer.size() + len > WRITE_BUFFER_SIZE)
+    {
+        if (!m_pack.writeAll(m_buffer.data(), m_buffer.size()))
+        {
+            return false;
+        }
+        m_buffer.clear();
+    }
+    if (len >= WRITE_BUFFER_SIZE)
+    {
+        // a video goes straight through
+        if (!m_pack.writeAll(data, len))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        m_buffer.insert(m_buffer.end(), data, data + len);
+    }
+    m_end += len;
+    return true;
+}
+
+void PackSink::appendIndex(const ExtractorHelpers::PayloadInfo& info, uint64_t offset)
+{
+    m_indexLines += escape_index_field(info.sourcePath)
+        + '\t' + std::to_string(offset)
+        + '\t' + std::to_string(info.size)
+        + '\t' + info.xxh64
+        + '\t' + (info.sha256.empty() ? std::string("-") : info.sha256)
+        + '\n';
+}
+
+ExtractorHelpers::SinkResult PackSink::write(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                             ExtractorHelpers::OutputRef& ref)
+{
+    // ustar size field holds 11 octal digits
+    if (info.size >= (1ULL << 33))
+    {
+        return ExtractorHelpers::SinkResult::WRITE_ERROR;
+    }
+
+    // extracting the tar would let the later member replace the earlier
+    if (!claimName(info.entryName, info.sourcePath))
+    {
+        return ExtractorHelpers::SinkResult::NAME_TAKEN;
+    }
+
+    const std::vector<uint8_t> headers = tarHeaders(info.entryName, info.size);
+    static const uint8_t padding[TAR_BLOCK_SIZE] = {};
+    const size_t paddingSize = tarPadding(info.size);
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_failed)
+    {
+        return ExtractorHelpers::SinkResult::WRITE_ERROR;
+    }
+    if (!m_inBatch && !beginBatch())
+    {
+        return ExtractorHelpers::SinkResult::OPEN_ERROR;
+    }
+
+    const uint64_t memberOffset = m_end;
+    if (!appendPack(headers.data(), headers.size())
+        || !appendPack(data, static_cast<size_t>(info.size))
+        || !appendPack(padding, paddingSize))
+    {
+        failBatch();
+        return ExtractorHelpers::SinkResult::WRITE_ERROR;
+    }
+    ref.location = m_packPath;
+    ref.offset = memberOffset + headers.size();
+    appendIndex(info, ref.offset);
+
+    if ((++m_batchMembers >= BATCH_MEMBERS || m_end - m_batchStart >= BATCH_BYTES) && !commitBatch())
+    {
+        return ExtractorHelpers::SinkResult::WRITE_ERROR;
+    }
+    return ExtractorHelpers::SinkResult::Ok;
+}
+
+ExtractorHelpers::SinkResult PackSink::writeDuplicate(const ExtractorHelpers::PayloadInfo& info, const uint8_t*,
+                                                      const ExtractorHelpers::OutputRef& original,
+                                                      ExtractorHelpers::OutputRef& ref)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_failed)
+    {
+        return ExtractorHelpers::SinkResult::WRITE_ERROR;
+    }
+    if (!m_inBatch && !beginBatch())
+    {
+        return ExtractorHelpers::SinkResult::OPEN_ERROR;
+    }
+    appendIndex(info, original.offset);
+    if (++m_batchMembers >= BATCH_MEMBERS && !commitBatch())
+    {
+        return ExtractorHelpers::SinkResult::WRITE_ERROR;
+    }
+    ref = original;
+    return ExtractorHelpers::SinkResult::Ok;
+}
+
+void PackSink::whenDurable(const std::function<void(bool)>& action)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_inBatch)
+    {
+        m_actions.push_back(action);
+    }
+    else
+    {
+        // everything written so far is committed, or lost for good
+        action(!m_failed);
+    }
+}
+
+bool PackSink::flush()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_inBatch ? commitBatch() : !m_failed;
+}
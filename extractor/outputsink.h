@@ -0,0 +1,256 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+#include <platformfile.h>
+#include <syncbatcher.h>
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace ExtractorHelpers
+{
+    enum class SinkResult : int
+    {
+        Ok = 0,
+        OPEN_ERROR,
+        WRITE_ERROR,
+        NAME_TAKEN,     // another payload of this run already has the name
+    };
+
+    struct PayloadInfo
+    {
+        std::string sourcePath;     // input the payload came from
+        std::string entryName;      // file name the payload should get in the output
+        uint64_t    size = 0;
+        std::string xxh64;
+        std::string sha256;         // empty unless requested
+    };
+
+    // where a payload ended up: a file, or a pack and the payload offset in it
+    struct OutputRef
+    {
+        std::string location;
+        uint64_t    offset = 0;
+    };
+
+    // how file sinks put their files on disk, the defaults are plain
+    // buffered writes left to the OS to flush
+    struct OutputPolicy
+    {
+        bool        preallocate = false;    // reserve the payload size before the first byte
+        bool        atomicRename = false;   // write "<name>.part", rename once complete
+        uint64_t    directMinSize = 0;      // payloads this big bypass the page cache, 0 never
+        SyncBatcher* sync = nullptr;        // grouped syncs of finished files, none when null
+    };
+}
+
+// A payload written piece by piece, for copies that never hold it whole.
+// Its digests are only known once the last piece went through.
+class OutputStream
+{
+public:
+    virtual ~OutputStream() {}
+
+    virtual bool write(const uint8_t* data, size_t len) = 0;
+    // see PlatformFile::copyFrom
+    virtual bool copyFrom(PlatformFile&, uint64_t, uint64_t, uint64_t& copied)
+    {
+        copied = 0;
+        return false;
+    }
+    virtual ExtractorHelpers::SinkResult finish(const ExtractorHelpers::PayloadInfo& info, ExtractorHelpers::OutputRef& ref) = 0;
+    // drops the partial output
+    virtual void abort() = 0;
+};
+
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {}
+
+    virtual ExtractorHelpers::SinkResult write(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                               ExtractorHelpers::OutputRef& ref) = 0;
+
+    // Stores a payload identical to one written before. Sinks that can
+    // reference the original do so, the default writes the data again.
+    virtual ExtractorHelpers::SinkResult writeDuplicate(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                                        const ExtractorHelpers::OutputRef&,
+                                                        ExtractorHelpers::OutputRef& ref)
+    {
+        return write(info, data, ref);
+    }
+
+    // Stores the JSON description of the payload written to ref. Sinks
+    // without a natural place for it rely on the manifest instead.
+    virtual ExtractorHelpers::SinkResult writeSidecar(const ExtractorHelpers::OutputRef&, const std::string&)
+    {
+        return ExtractorHelpers::SinkResult::Ok;
+    }
+
+    // null when the sink needs the whole payload at once
+    virtual std::unique_ptr<OutputStream> openStream(const ExtractorHelpers::PayloadInfo&)
+    {
+        return nullptr;
+    }
+
+    // Runs action(true) once everything written so far is as durable as
+    // the sink makes it, action(false) when it was lost on the way. Sinks
+    // that hold nothing back run it right away.
+    virtual void whenDurable(const std::function<void(bool)>& action)
+    {
+        action(true);
+    }
+
+    // writes out whatever the sink holds back; false when that failed
+    virtual bool flush()
+    {
+        return true;
+    }
+
+    // "out/IMG_0001.mp4" -> "out/IMG_0001.json"
+    static std::string sidecarPath(const std::string& location);
+
+protected:
+    // First come, first served: false when the name was handed to
+    // another source before, so two inputs never write (or race on) the
+    // same output.
+    bool claimName(const std::string& name, const std::string& sourcePath);
+
+private:
+    std::mutex                                      m_namesMutex;
+    std::unordered_map<std::string, std::string>    m_names;
+};
+
+// one output file, the original behaviour
+class FileSink : public OutputSink
+{
+public:
+    FileSink(const std::string& outputPath,
+             const ExtractorHelpers::OutputPolicy& policy = ExtractorHelpers::OutputPolicy());
+
+    ExtractorHelpers::SinkResult write(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                       ExtractorHelpers::OutputRef& ref) override;
+    ExtractorHelpers::SinkResult writeSidecar(const ExtractorHelpers::OutputRef& ref, const std::string& json) override;
+    std::unique_ptr<OutputStream> openStream(const ExtractorHelpers::PayloadInfo& info) override;
+    // the file is durable once the policy's sync batcher synced it
+    void whenDurable(const std::function<void(bool)>& action) override;
+    bool flush() override;
+
+private:
+    std::string                     m_outputPath;
+    ExtractorHelpers::OutputPolicy  m_policy;
+};
+
+// one file per payload, named by entryName, inside an existing directory;
+// subdirectories in entryName are created, a name used twice is refused;
+// duplicates are hard links to the first copy
+class DirectorySink : public OutputSink
+{
+public:
+    DirectorySink(const std::string& outputDir,
+                  const ExtractorHelpers::OutputPolicy& policy = ExtractorHelpers::OutputPolicy());
+
+    ExtractorHelpers::SinkResult write(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                       ExtractorHelpers::OutputRef& ref) override;
+    ExtractorHelpers::SinkResult writeDuplicate(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                                const ExtractorHelpers::OutputRef& original,
+                                                ExtractorHelpers::OutputRef& ref) override;
+    ExtractorHelpers::SinkResult writeSidecar(const ExtractorHelpers::OutputRef& ref, const std::string& json) override;
+    std::unique_ptr<OutputStream> openStream(const ExtractorHelpers::PayloadInfo& info) override;
+    // files are durable once the policy's sync batcher synced them
+    void whenDurable(const std::function<void(bool)>& action) override;
+    bool flush() override;
+
+private:
+    // claims the name and creates its directories
+    ExtractorHelpers::SinkResult prepare(const ExtractorHelpers::PayloadInfo& info);
+
+    std::string                     m_outputDir;
+    ExtractorHelpers::OutputPolicy  m_policy;
+};
+
+// Appends every payload to one tar (ustar) file and records it in a
+// "<pack>.idx" sidecar: source path, payload offset, length, XXH64 and
+// SHA-256 ("-" when not computed), tab separated; backslash, tab, CR and
+// LF in the path are escaped as \\, \t, \r and \n. Both files stay open
+// for the sink's life and members are appended in batches. The pack is
+// locked for a batch, so several processes may share it. A batch is
+// committed once it holds BATCH_MEMBERS members or BATCH_BYTES bytes, and
+// on flush(): its members and the end-of-archive blocks are written and
+// synced first, its index lines after them, so a killed writer never
+// leaves an index entry pointing to a partial member. The next batch
+// first cuts the pack back to the end of the last indexed member, so a
+// torn batch is dropped and the file stays a readable tar. The pack
+// belongs to its index, so a non-empty file without one is refused rather
+// than cut. Member names are claimed like directory outputs, a second
+// payload for a name is refused. Duplicates only get an index line
+// pointing at the first copy.
+// A failed batch is final: its members are lost and later writes fail.
+class PackSink : public OutputSink
+{
+public:
+    static const size_t BATCH_MEMBERS = 256;
+    static const uint64_t BATCH_BYTES = 64 * 1024 * 1024;
+
+    PackSink(const std::string& packPath);
+    // commits the open batch
+    ~PackSink() override;
+
+    // Opens the pack and its index. False when packPath holds data but has
+    // no index: it isn't a pack written by this sink, appending would cut
+    // it back to nothing.
+    bool open();
+
+    ExtractorHelpers::SinkResult write(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                       ExtractorHelpers::OutputRef& ref) override;
+    ExtractorHelpers::SinkResult writeDuplicate(const ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                                const ExtractorHelpers::OutputRef& original,
+                                                ExtractorHelpers::OutputRef& ref) override;
+    // members are durable once their batch is committed
+    void whenDurable(const std::function<void(bool)>& action) override;
+    bool flush() override;
+
+    static std::string indexPath(const std::string& packPath);
+
+private:
+    // pack bytes of a batch gather up to this much before a write
+    static const size_t WRITE_BUFFER_SIZE = 1024 * 1024;
+
+    // locks the pack and recovers it; these helpers run with m_mutex held
+    bool beginBatch();
+    bool commitBatch();
+    // drops the batch and fails whoever waits for it
+    void failBatch();
+    // drops a torn index line and whatever follows the last indexed
+    // member, leaves both files positioned for an append
+    bool recover();
+    bool appendPack(const uint8_t* data, size_t len);
+    void appendIndex(const ExtractorHelpers::PayloadInfo& info, uint64_t offset);
+
+    std::string                             m_packPath;
+    std::mutex                              m_mutex;
+    PlatformFile                            m_pack;
+    PlatformFile                            m_index;
+    // index lines read so far (by any process) and the pack end they give
+    uint64_t                                m_indexRead;
+    uint64_t                                m_committedEnd;
+    // the open batch: where it and the next member start, pack bytes and
+    // index lines not written yet, and the actions waiting for its commit
+    bool                                    m_inBatch;
+    bool                                    m_failed;
+    uint64_t                                m_batchStart;
+    uint64_t                                m_end;
+    std::vector<uint8_t>                    m_buffer;
+    std::string                             m_indexLines;
+    size_t                                  m_batchMembers;
+    std::vector<std::function<void(bool)>>  m_actions;
+};
+
+#endif // OUTPUTSINK_H
@@ -0,0 +1,522 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "platformfile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdio.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#ifdef _WIN32
+
+PlatformFile::PlatformFile()
+    : m_handle(INVALID_HANDLE_VALUE)
+{
+}
+
+bool PlatformFile::open(const std::string& path, OpenMode mode)
+{
+    close();
+    DWORD access = GENERIC_READ;
+    DWORD disposition = OPEN_EXISTING;
+    if (mode == OpenMode::WRITE_TRUNCATE)
+    {
+        access = GENERIC_WRITE;
+        disposition = CREATE_ALWAYS;
+    }
+    else if (mode == OpenMode::WRITE_APPEND)
+    {
+        access = FILE_APPEND_DATA;
+        disposition = OPEN_ALWAYS;
+    }
+    else if (mode == OpenMode::READ_WRITE)
+    {
+        access = GENERIC_READ | GENERIC_WRITE;
+        disposition = OPEN_ALWAYS;
+    }
+    m_handle = CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+    return m_handle != INVALID_HANDLE_VALUE;
+}
+
+void PlatformFile::close()
+{
+    if (m_handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_handle);
+        m_handle = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool PlatformFile::isOpen() const
+{
+    return m_handle != INVALID_HANDLE_VALUE;
+}
+
+bool PlatformFile::lockExclusive()
+{
+    OVERLAPPED ov = {};
+    return LockFileEx(m_handle, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &ov) != 0;
+}
+
+bool PlatformFile::unlock()
+{
+    OVERLAPPED ov = {};
+    return UnlockFileEx(m_handle, 0, MAXDWORD, MAXDWORD, &ov) != 0;
+}
+
+int64_t PlatformFile::size()
+{
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(m_handle, &sz))
+    {
+        return -1;
+    }
+    return sz.QuadPart;
+}
+
+bool PlatformFile::truncate(uint64_t size)
+{
+    LARGE_INTEGER pos;
+    pos.QuadPart = static_cast<LONGLONG>(size);
+    return SetFilePointerEx(m_handle, pos, nullptr, FILE_BEGIN) && SetEndOfFile(m_handle);
+}
+
+bool PlatformFile::hardLink(const std::string& existingPath, const std::string& newPath)
+{
+    DeleteFileA(newPath.c_str());
+    return CreateHardLinkA(newPath.c_str(), existingPath.c_str(), nullptr) != 0;
+}
+
+bool PlatformFile::writeAll(const uint8_t* data, size_t len)
+{
+    while (len)
+    {
+        DWORD chunk = len > 0x40000000 ? 0x40000000 : static_cast<DWORD>(len);
+        DWORD written = 0;
+        if (!WriteFile(m_handle, data, chunk, &written, nullptr) || written == 0)
+        {
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+bool PlatformFile::sync()
+{
+    return FlushFileBuffers(m_handle) != 0;
+}
+
+bool PlatformFile::listFiles(const std::string& dir, std::vector<std::string>& files)
+{
+    std::vector<std::string> pending(1, std::string());
+    bool first = true;
+    while (!pending.empty())
+    {
+        std::string rel = pending.back();
+        pending.pop_back();
+        WIN32_FIND_DATAA entry;
+        HANDLE find = FindFirstFileA((dir + "\\" + rel + "*").c_str(), &entry);
+        if (find == INVALID_HANDLE_VALUE)
+        {
+            if (first)
+            {
+                return false;
+            }
+            continue;
+        }
+        first = false;
+        do
+        {
+            std::string name = entry.cFileName;
+            if (name == "." || name == ".." || (entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            {
+                continue;
+            }
+            if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                pending.push_back(rel + name + "\\");
+            }
+            else
+            {
+                files.push_back(rel + name);
+            }
+        } while (FindNextFileA(find, &entry));
+        FindClose(find);
+    }
+    return true;
+}
+
+bool PlatformFile::copyFrom(PlatformFile&, uint64_t, uint64_t, uint64_t& copied)
+{
+    // no range copy between handles, CopyFileEx only does whole files
+    copied = 0;
+    return false;
+}
+
+bool PlatformFile::remove(const std::string& path)
+{
+    return DeleteFileA(path.c_str()) != 0;
+}
+
+bool PlatformFile::preallocate(uint64_t len)
+{
+    FILE_ALLOCATION_INFO allocation;
+    allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(len);
+    return SetFileInformationByHandle(m_handle, FileAllocationInfo, &allocation, sizeof(allocation)) != 0;
+}
+
+bool PlatformFile::setDirect(bool enable)
+{
+    // FILE_FLAG_NO_BUFFERING is fixed at open, the unaligned tail couldn't
+    // be written through the same handle
+    return !enable;
+}
+
+bool PlatformFile::rename(const std::string& oldPath, const std::string& newPath)
+{
+    // a directory can't be flushed by itself here, the move is instead
+    return MoveFileExA(oldPath.c_str(), newPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+bool PlatformFile::createDirectories(const std::string& dir)
+{
+    for (size_t pos = dir.find_first_of("/\\", 1); ; pos = dir.find_first_of("/\\", pos + 1))
+    {
+        const std::string part = dir.substr(0, pos);
+        if (!part.empty() && part.back() != ':' && !CreateDirectoryA(part.c_str(), nullptr)
+            && GetLastError() != ERROR_ALREADY_EXISTS)
+        {
+            return false;
+        }
+        if (pos == std::string::npos)
+        {
+            return true;
+        }
+    }
+}
+
+bool PlatformFile::syncPath(const std::string& path)
+{
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    bool ok = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return ok;
+}
+
+bool PlatformFile::syncDirectory(const std::string&)
+{
+    // rename() writes through already
+    return true;
+}
+
+bool PlatformFile::syncFileSystem(const std::string&)
+{
+    // flushing a volume needs administrator rights
+    return false;
+}
+
+#else
+
+PlatformFile::PlatformFile()
+    : m_fd(-1)
+{
+}
+
+bool PlatformFile::open(const std::string& path, OpenMode mode)
+{
+    close();
+    int flags = O_RDONLY;
+    if (mode == OpenMode::WRITE_TRUNCATE)
+    {
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    }
+    else if (mode == OpenMode::WRITE_APPEND)
+    {
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    }
+    else if (mode == OpenMode::READ_WRITE)
+    {
+        flags = O_RDWR | O_CREAT;
+    }
+    m_fd = ::open(path.c_str(), flags, 0644);
+    return m_fd >= 0;
+}
+
+void PlatformFile::close()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool PlatformFile::isOpen() const
+{
+    return m_fd >= 0;
+}
+
+bool PlatformFile::lockExclusive()
+{
+    // fcntl locks rather than flock: they are honoured over NFS
+    struct flock fl = {};
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    int res = 0;
+    do
+    {
+        res = fcntl(m_fd, F_SETLKW, &fl);
+    } while (res < 0 && errno == EINTR);
+    return res == 0;
+}
+
+bool PlatformFile::unlock()
+{
+    struct flock fl = {};
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    return fcntl(m_fd, F_SETLK, &fl) == 0;
+}
+
+int64_t PlatformFile::size()
+{
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+        return -1;
+    }
+    return static_cast<int64_t>(st.st_size);
+}
+
+bool PlatformFile::truncate(uint64_t size)
+{
+    return ::ftruncate(m_fd, static_cast<off_t>(size)) == 0
+        && ::lseek(m_fd, static_cast<off_t>(size), SEEK_SET) >= 0;
+}
+
+bool PlatformFile::hardLink(const std::string& existingPath, const std::string& newPath)
+{
+    ::unlink(newPath.c_str());
+    return ::link(existingPath.c_str(), newPath.c_str()) == 0;
+}
+
+bool PlatformFile::writeAll(const uint8_t* data, size_t len)
+{
+    while (len)
+    {
+        ssize_t written = ::write(m_fd, data, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        len -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool PlatformFile::sync()
+{
+    return ::fsync(m_fd) == 0;
+}
+
+bool PlatformFile::listFiles(const std::string& dir, std::vector<std::string>& files)
+{
+    std::vector<std::string> pending(1, std::string());
+    bool first = true;
+    while (!pending.empty())
+    {
+        std::string rel = pending.back();
+        pending.pop_back();
+        const std::string path = dir + "/" + rel;
+        DIR* handle = ::opendir(path.c_str());
+        if (!handle)
+        {
+            if (first)
+            {
+                return false;
+            }
+            // unreadable subdirectory, the rest of the tree is still worth it
+            continue;
+        }
+        first = false;
+        while (struct dirent* entry = ::readdir(handle))
+        {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..")
+            {
+                continue;
+            }
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN)
+            {
+                // some file systems don't fill d_type
+                struct stat st;
+                if (::lstat((path + name).c_str(), &st) != 0)
+                {
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_LNK);
+            }
+            if (type == DT_DIR)
+            {
+                pending.push_back(rel + name + "/");
+            }
+            else if (type == DT_REG)
+            {
+                files.push_back(rel + name);
+            }
+        }
+        ::closedir(handle);
+    }
+    return true;
+}
+
+bool PlatformFile::copyFrom(PlatformFile& input, uint64_t offset, uint64_t len, uint64_t& copied)
+{
+    copied = 0;
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    // the syscall directly, older C libraries have no wrapper for it
+    loff_t inOffset = static_cast<loff_t>(offset);
+    while (copied < len)
+    {
+        const uint64_t left = len - copied;
+        const size_t chunk = left > 0x40000000 ? 0x40000000 : static_cast<size_t>(left);
+        long res = ::syscall(SYS_copy_file_range, input.m_fd, &inOffset, m_fd, nullptr, chunk, 0u);
+        if (res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (res <= 0)
+        {
+            // EXDEV, ENOSYS, EOPNOTSUPP... or the input ended early
+            return false;
+        }
+        copied += static_cast<uint64_t>(res);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool PlatformFile::remove(const std::string& path)
+{
+    return ::unlink(path.c_str()) == 0;
+}
+
+bool PlatformFile::preallocate(uint64_t len)
+{
+#ifdef __linux__
+    // KEEP_SIZE: a copy that stops short leaves no zero tail behind
+    int res = 0;
+    do
+    {
+        res = ::fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(len));
+    } while (res < 0 && errno == EINTR);
+    return res == 0;
+#else
+    return false;
+#endif
+}
+
+bool PlatformFile::setDirect(bool enable)
+{
+#if defined(__linux__) && defined(O_DIRECT)
+    int flags = fcntl(m_fd, F_GETFL);
+    if (flags < 0)
+    {
+        return false;
+    }
+    flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return fcntl(m_fd, F_SETFL, flags) == 0;
+#elif defined(__APPLE__)
+    // F_NOCACHE has no alignment rules of its own, aligned writes satisfy it too
+    return fcntl(m_fd, F_NOCACHE, enable ? 1 : 0) == 0;
+#else
+    return !enable;
+#endif
+}
+
+bool PlatformFile::rename(const std::string& oldPath, const std::string& newPath)
+{
+    return ::rename(oldPath.c_str(), newPath.c_str()) == 0;
+}
+
+bool PlatformFile::createDirectories(const std::string& dir)
+{
+    for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1))
+    {
+        const std::string part = dir.substr(0, pos);
+        if (::mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            return false;
+        }
+        if (pos == std::string::npos)
+        {
+            return true;
+        }
+    }
+}
+
+bool PlatformFile::syncPath(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+bool PlatformFile::syncDirectory(const std::string& dir)
+{
+    return syncPath(dir.empty() ? std::string(".") : dir);
+}
+
+bool PlatformFile::syncFileSystem(const std::string& path)
+{
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = ::syncfs(fd) == 0;
+    ::close(fd);
+    return ok;
+#else
+    // no per file system call, sync() covers every mounted one
+    ::sync();
+    return true;
+#endif
+}
+
+#endif
+
+PlatformFile::~PlatformFile()
+{
+    close();
+}
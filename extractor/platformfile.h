@@ -0,0 +1,83 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef PLATFORMFILE_H
+#define PLATFORMFILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Thin wrapper over native file handles. std::ofstream can't lock, append
+// atomically or report the real file size, which the output sinks need.
+class PlatformFile
+{
+public:
+    enum class OpenMode
+    {
+        READ_ONLY,
+        WRITE_TRUNCATE,
+        WRITE_APPEND,
+        READ_WRITE,         // created if missing, kept otherwise
+    };
+
+    PlatformFile();
+    ~PlatformFile();
+
+    bool open(const std::string& path, OpenMode mode);
+    void close();
+    bool isOpen() const;
+
+    // whole-file advisory lock, shared between processes (and NFS clients)
+    bool lockExclusive();
+    bool unlock();
+
+    int64_t size();
+    // cuts or extends the file to size and moves the position there
+    bool truncate(uint64_t size);
+    // existing path is kept, newPath is replaced if present
+    static bool hardLink(const std::string& existingPath, const std::string& newPath);
+    bool writeAll(const uint8_t* data, size_t len);
+    // flushes what was written through this handle to disk
+    bool sync();
+    // Kernel side copy of an input range to the current position, no
+    // user space buffer involved. False when the platform or the pair of
+    // file systems can't do it, copied tells how far it got.
+    bool copyFrom(PlatformFile& input, uint64_t offset, uint64_t len, uint64_t& copied);
+    // Reserves disk space for len bytes without changing the file size, so
+    // a file whose length is known up front isn't grown extent by extent.
+    // Only a hint, false when the file system can't.
+    bool preallocate(uint64_t len);
+    // Writes bypass the page cache. While enabled they must come from
+    // DIRECT_ALIGNMENT aligned memory, in multiples of it, at aligned
+    // offsets. False when the platform or file system can't.
+    bool setDirect(bool enable);
+    static const size_t DIRECT_ALIGNMENT = 4096;
+    static bool remove(const std::string& path);
+    // newPath is replaced if present, atomically where the platform can;
+    // the new name is durable once the directory holding it is synced
+    static bool rename(const std::string& oldPath, const std::string& newPath);
+    // dir and any missing parents, true when they exist afterwards
+    static bool createDirectories(const std::string& dir);
+    // flushes one file to disk
+    static bool syncPath(const std::string& path);
+    // flushes the entries of dir, e.g. names created by rename()
+    static bool syncDirectory(const std::string& dir);
+    // flushes everything on the file system holding path, false when the
+    // platform can't
+    static bool syncFileSystem(const std::string& path);
+    // regular files under dir, recursively, as paths relative to dir;
+    // symbolic links are not followed
+    static bool listFiles(const std::string& dir, std::vector<std::string>& files);
+
+private:
+    PlatformFile(const PlatformFile&) = delete;
+    PlatformFile& operator=(const PlatformFile&) = delete;
+
+#ifdef _WIN32
+    void*   m_handle;
+#else
+    int     m_fd;
+#endif
+};
+
+#endif // PLATFORMFILE_H
@@ -0,0 +1,207 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "readplanner.h"
+
+#include <algorithm>
+#include <thread>
+#include <string.h>
+
+ReadPlanner::ReadPlanner(HeifUtils::RangeReader& backend)
+    : m_backend(backend)
+    , m_wholeFileLimit(HEAD_PROBE_SIZE + TAIL_PROBE_SIZE + MIN_FETCH_SIZE)
+    , m_budget(nullptr)
+    , m_charged(0)
+{
+}
+
+ReadPlanner::~ReadPlanner()
+{
+    dropCache();
+}
+
+void ReadPlanner::setBudget(MemoryBudget* budget)
+{
+    dropCache();
+    m_budget = budget;
+}
+
+void ReadPlanner::setWholeFileLimit(uint64_t limit)
+{
+    m_wholeFileLimit = std::max<uint64_t>(limit, HEAD_PROBE_SIZE + TAIL_PROBE_SIZE + MIN_FETCH_SIZE);
+}
+
+HeifUtils::RangeReader& ReadPlanner::backend()
+{
+    return m_backend;
+}
+
+const uint8_t* ReadPlanner::cached(uint64_t offset, size_t len) const
+{
+    const Segment* segment = findSegment(offset);
+    if (!segment || offset + len > segment->offset + segment->data.size())
+    {
+        return nullptr;
+    }
+    return segment->data.data() + (offset - segment->offset);
+}
+
+void ReadPlanner::dropCache()
+{
+    std::vector<Segment>().swap(m_segments);
+    if (m_charged)
+    {
+        m_budget->discharge(m_charged);
+        m_charged = 0;
+    }
+}
+
+int64_t ReadPlanner::size()
+{
+    return m_backend.size();
+}
+
+bool ReadPlanner::prefetch()
+{
+    int64_t total = m_backend.size();
+    if (total < 0)
+    {
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(total);
+    if (fileSize <= m_wholeFileLimit)
+    {
+        // small enough that the whole file is cheaper than separate probes
+        return fetch(0, static_cast<size_t>(fileSize));
+    }
+    return fetch(0, HEAD_PROBE_SIZE) && fetch(fileSize - TAIL_PROBE_SIZE, TAIL_PROBE_SIZE);
+}
+
+bool ReadPlanner::fetch(uint64_t offset, size_t len)
+{
+    if (m_budget)
+    {
+        m_budget->charge(len);
+        m_charged += len;
+    }
+    Segment segment;
+    segment.offset = offset;
+    segment.data.resize(len);
+    if (len && !m_backend.read(offset, len, segment.data.data()))
+    {
+        return false;
+    }
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), offset,
+                               [](uint64_t pos, const Segment& s) { return pos < s.offset; });
+    m_segments.insert(it, std::move(segment));
+    return true;
+}
+
+const ReadPlanner::Segment* ReadPlanner::findSegment(uint64_t pos) const
+{
+    for (const auto& segment : m_segments)
+    {
+        if (pos >= segment.offset && pos < segment.offset + segment.data.size())
+        {
+            return &segment;
+        }
+    }
+    return nullptr;
+}
+
+uint64_t ReadPlanner::nextSegmentStart(uint64_t pos, uint64_t end) const
+{
+    for (const auto& segment : m_segments)
+    {
+        if (segment.offset > pos)
+        {
+            return std::min(segment.offset, end);
+        }
+    }
+    return end;
+}
+
+bool ReadPlanner::read(uint64_t offset, size_t len, uint8_t* dst)
+{
+    return readStream(offset, len, dst, len ? len : 1, [](const uint8_t*, size_t) { return true; });
+}
+
+bool ReadPlanner::readStream(uint64_t offset, size_t len, uint8_t* dst, size_t chunkSize, const ChunkCallback& onChunk)
+{
+    int64_t total = m_backend.size();
+    const uint64_t end = offset + len;
+    if (total < 0 || end > static_cast<uint64_t>(total))
+    {
+        return false;
+    }
+
+    uint64_t pos = offset;
+    while (pos < end)
+    {
+        const Segment* segment = findSegment(pos);
+        if (segment)
+        {
+            uint64_t segmentEnd = segment->offset + segment->data.size();
+            size_t count = static_cast<size_t>(std::min(end, segmentEnd) - pos);
+            const uint8_t* src = segment->data.data() + (pos - segment->offset);
+            memcpy(dst + (pos - offset), src, count);
+            for (size_t done = 0; done < count; done += chunkSize)
+            {
+                size_t piece = std::min(chunkSize, count - done);
+                if (!onChunk(dst + (pos - offset) + done, piece))
+                {
+                    return false;
+                }
+            }
+            pos += count;
+            continue;
+        }
+
+        uint64_t gapEnd = nextSegmentStart(pos, end);
+        size_t gap = static_cast<size_t>(gapEnd - pos);
+        if (gap >= MIN_FETCH_SIZE)
+        {
+            // exactly the missing bytes, straight into the caller's buffer
+            if (!m_backend.readStream(pos, gap, dst + (pos - offset), chunkSize, onChunk))
+            {
+                return false;
+            }
+            pos = gapEnd;
+        }
+        else
+        {
+            size_t fetchLen = static_cast<size_t>(std::min(static_cast<uint64_t>(MIN_FETCH_SIZE), static_cast<uint64_t>(total) - pos));
+            if (!fetch(pos, fetchLen))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+LatencyRangeReader::LatencyRangeReader(std::unique_ptr<HeifUtils::RangeReader> inner, std::chrono::microseconds latency)
+    : m_inner(std::move(inner))
+    , m_latency(latency)
+{
+}
+
+int64_t LatencyRangeReader::size()
+{
+    return m_inner->size();
+}
+
+bool LatencyRangeReader::read(uint64_t offset, size_t len, uint8_t* dst)
+{
+    ++m_requests;
+    m_bytes += len;
+    std::this_thread::sleep_for(m_latency);
+    return m_inner->read(offset, len, dst);
+}
+
+bool LatencyRangeReader::readStream(uint64_t offset, size_t len, uint8_t* dst, size_t chunkSize, const ChunkCallback& onChunk)
+{
+    ++m_requests;
+    m_bytes += len;
+    std::this_thread::sleep_for(m_latency);
+    return m_inner->readStream(offset, len, dst, chunkSize, onChunk);
+}
@@ -0,0 +1,86 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef READPLANNER_H
+#define READPLANNER_H
+
+#include <rangereader.h>
+#include <memorybudget.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// Sits between the parsers and a (possibly remote) RangeReader and keeps
+// the number of requests minimal: prefetch() fetches the header and a
+// speculative tail in one go (one request when they meet), small reads are
+// widened and cached so neighbouring box headers cost nothing, and a
+// large read is issued as one request for exactly the missing bytes.
+// For a typical file that's the probe, one sefd/segment fetch if the
+// video isn't in the probes already, and the video range.
+class ReadPlanner : public HeifUtils::RangeReader
+{
+public:
+    static const size_t HEAD_PROBE_SIZE = 64 * 1024;
+    static const size_t TAIL_PROBE_SIZE = 64 * 1024;
+    // gaps smaller than this are fetched whole and cached
+    static const size_t MIN_FETCH_SIZE = 64 * 1024;
+
+    ReadPlanner(HeifUtils::RangeReader& backend);
+    ~ReadPlanner();
+
+    // cached segments are charged to budget while they're held
+    void setBudget(MemoryBudget* budget);
+
+    // files up to this size are fetched whole by prefetch(): on a disk one
+    // sequential read beats seeking to the header, trailer and video
+    void setWholeFileLimit(uint64_t limit);
+    bool prefetch();
+
+    int64_t size() override;
+    bool read(uint64_t offset, size_t len, uint8_t* dst) override;
+    bool readStream(uint64_t offset, size_t len, uint8_t* dst, size_t chunkSize, const ChunkCallback& onChunk) override;
+
+    HeifUtils::RangeReader& backend();
+    // the range straight from one cached segment, nullptr when it isn't
+    const uint8_t* cached(uint64_t offset, size_t len) const;
+    // frees the cache, later reads go to the backend
+    void dropCache();
+
+private:
+    struct Segment
+    {
+        uint64_t                offset;
+        std::vector<uint8_t>    data;
+    };
+
+    bool fetch(uint64_t offset, size_t len);
+    // cached segment holding pos, nullptr if none
+    const Segment* findSegment(uint64_t pos) const;
+    // start of the first cached segment after pos, or end
+    uint64_t nextSegmentStart(uint64_t pos, uint64_t end) const;
+
+    HeifUtils::RangeReader& m_backend;
+    std::vector<Segment>    m_segments;
+    uint64_t                m_wholeFileLimit;
+    MemoryBudget*           m_budget;
+    uint64_t                m_charged;
+};
+
+// Local stand-in for an object store: every request to the wrapped reader
+// pays a fixed latency, so round trips can be counted and benchmarked
+// offline.
+class LatencyRangeReader : public HeifUtils::RangeReader
+{
+public:
+    LatencyRangeReader(std::unique_ptr<HeifUtils::RangeReader> inner, std::chrono::microseconds latency);
+
+    int64_t size() override;
+    bool read(uint64_t offset, size_t len, uint8_t* dst) override;
+    bool readStream(uint64_t offset, size_t len, uint8_t* dst, size_t chunkSize, const ChunkCallback& onChunk) override;
+
+private:
+    std::unique_ptr<HeifUtils::RangeReader> m_inner;
+    std::chrono::microseconds               m_latency;
+};
+
+#endif // READPLANNER_H
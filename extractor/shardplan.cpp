@@ -0,0 +1,258 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "shardplan.h"
+#include "hash.h"
+
+#include <sstream>
+
+namespace
+{
+    std::string normalize_path(const std::string& path)
+    {
+        std::string res = path;
+        for (auto& c : res)
+        {
+            if (c == '\\')
+            {
+                c = '/';
+            }
+        }
+        while (res.compare(0, 2, "./") == 0)
+        {
+            res.erase(0, 2);
+        }
+        return res;
+    }
+
+    const char* result_name(ExtractorHelpers::ExtractResult result)
+    {
+        switch (result)
+        {
+        case ExtractorHelpers::ExtractResult::Ok:
+            return "ok";
+        case ExtractorHelpers::ExtractResult::NO_VIDEO:
+            return "no_video";
+        case ExtractorHelpers::ExtractResult::UNSUPPORTED_FORMAT:
+            return "unsupported";
+        case ExtractorHelpers::ExtractResult::INVALID_VIDEO:
+            return "invalid";
+        default:
+            return "failed";
+        }
+    }
+
+    bool result_from_name(const std::string& name, ExtractorHelpers::ExtractResult& result)
+    {
+        static const ExtractorHelpers::ExtractResult known[] = {
+            ExtractorHelpers::ExtractResult::Ok,
+            ExtractorHelpers::ExtractResult::NO_VIDEO,
+            ExtractorHelpers::ExtractResult::UNSUPPORTED_FORMAT,
+            ExtractorHelpers::ExtractResult::INVALID_VIDEO,
+        };
+        for (auto candidate : known)
+        {
+            if (name == result_name(candidate))
+            {
+                result = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+bool ShardSpec::parse(const std::string& spec, ShardSpec& shard)
+{
+    size_t slash = spec.find('/');
+    if (slash == std::string::npos)
+    {
+        return false;
+    }
+    try
+    {
+        shard.index = std::stoull(spec.substr(0, slash));
+        shard.count = std::stoull(spec.substr(slash + 1));
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+    return shard.count > 0 && shard.index < shard.count;
+}
+
+bool ShardSpec::contains(const std::string& relativePath) const
+{
+    if (count <= 1)
+    {
+        return true;
+    }
+    std::string key = normalize_path(relativePath);
+    Xxh64 hash;
+    hash.update(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+    return hash.digest() % count == index;
+}
+
+Checkpoint::Checkpoint(const std::string& path)
+    : m_path(path)
+{
+}
+
+bool Checkpoint::load()
+{
+    std::ifstream file(m_path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        // first run
+        return true;
+    }
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    while (true)
+    {
+        size_t eol = content.find('\n', pos);
+        if (eol == std::string::npos)
+        {
+            break;
+        }
+        std::string line = content.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        size_t tab = line.find('\t');
+        ExtractorHelpers::ExtractResult result;
+        if (tab != std::string::npos && result_from_name(line.substr(0, tab), result))
+        {
+            m_done[normalize_path(line.substr(tab + 1))] = result;
+        }
+    }
+    return true;
+}
+
+bool Checkpoint::open()
+{
+    m_file.open(m_path.c_str(), std::ios::binary | std::ios::app);
+    return m_file.is_open();
+}
+
+bool Checkpoint::isOpen() const
+{
+    return m_file.is_open();
+}
+
+bool Checkpoint::isDone(const std::string& relativePath) const
+{
+    return m_done.count(normalize_path(relativePath)) != 0;
+}
+
+void Checkpoint::addRecordedStats(const std::vector<std::string>& inputs, BatchStats& stats) const
+{
+    for (const auto& input : inputs)
+    {
+        auto it = m_done.find(normalize_path(input));
+        if (it == m_done.end())
+        {
+            continue;
+        }
+        switch (it->second)
+        {
+        case ExtractorHelpers::ExtractResult::Ok:
+            ++stats.extracted;
+            break;
+        case ExtractorHelpers::ExtractResult::NO_VIDEO:
+            ++stats.noVideo;
+            break;
+        case ExtractorHelpers::ExtractResult::UNSUPPORTED_FORMAT:
+            ++stats.unsupported;
+            break;
+        default:
+            ++stats.invalid;
+            break;
+        }
+    }
+}
+
+void Checkpoint::record(const std::string& relativePath, ExtractorHelpers::ExtractResult result)
+{
+    if (result == ExtractorHelpers::ExtractResult::READ_ERROR
+        || result == ExtractorHelpers::ExtractResult::WRITE_ERROR
+        || result == ExtractorHelpers::ExtractResult::NAME_TAKEN)
+    {
+        return;
+    }
+    std::string line = std::string(result_name(result)) + '\t' + normalize_path(relativePath) + '\n';
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_file << line;
+    m_file.flush();
+    if (!m_file)
+    {
+        // the inputs after it are simply redone by a resumed run
+        m_file.close();
+    }
+}
+
+namespace BatchReport
+{
+    std::string format(const BatchStats& stats)
+    {
+        std::ostringstream out;
+        out << "{\"extracted\":" << stats.extracted
+            << ",\"no_video\":" << stats.noVideo
+            << ",\"invalid\":" << stats.invalid
+            << ",\"unsupported\":" << stats.unsupported
+            << ",\"failed\":" << stats.failed
+            << ",\"read_requests\":" << stats.readRequests
+            << "}";
+        return out.str();
+    }
+
+    bool write(const std::string& path, const BatchStats& stats)
+    {
+        std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+        file << format(stats) << '\n';
+        file.close();
+        return !file.fail();
+    }
+
+    bool read(const std::string& path, BatchStats& stats)
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        struct Field
+        {
+            const char* name;
+            uint64_t*   value;
+        };
+        BatchStats parsed;
+        const Field fields[] = {
+            { "extracted", &parsed.extracted },
+            { "no_video", &parsed.noVideo },
+            { "invalid", &parsed.invalid },
+            { "unsupported", &parsed.unsupported },
+            { "failed", &parsed.failed },
+            { "read_requests", &parsed.readRequests },
+        };
+        for (const auto& field : fields)
+        {
+            std::string key = std::string("\"") + field.name + "\":";
+            size_t pos = content.find(key);
+            if (pos == std::string::npos)
+            {
+                return false;
+            }
+            try
+            {
+                *field.value = std::stoull(content.substr(pos + key.size()));
+            }
+            catch (const std::exception&)
+            {
+                return false;
+            }
+        }
+        stats += parsed;
+        return true;
+    }
+}
@@ -0,0 +1,61 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef SHARDPLAN_H
+#define SHARDPLAN_H
+
+#include <batchrunner.h>
+
+#include <stdint.h>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// "i/N": this node handles shard i (0 based) of N. Inputs are assigned by
+// XXH64 of their path relative to the archive root, so adding files never
+// moves existing ones to another shard.
+struct ShardSpec
+{
+    uint64_t    index = 0;
+    uint64_t    count = 1;
+
+    static bool parse(const std::string& spec, ShardSpec& shard);
+    bool contains(const std::string& relativePath) const;
+};
+
+// Append-only record of finished inputs, one "<result>\t<relative path>"
+// line each, flushed as soon as the input is done. Inputs that failed on
+// I/O or on an output name already taken are not recorded, so a resumed
+// run retries them; a line cut short by
+// a kill is ignored on load.
+class Checkpoint
+{
+public:
+    Checkpoint(const std::string& path);
+
+    bool load();
+    bool open();
+    // false after a line failed to reach the file, recording stops there
+    bool isOpen() const;
+    bool isDone(const std::string& relativePath) const;
+    // counts of the recorded results, to carry them into the node report
+    void addRecordedStats(const std::vector<std::string>& inputs, BatchStats& stats) const;
+    void record(const std::string& relativePath, ExtractorHelpers::ExtractResult result);
+
+private:
+    std::string                                                     m_path;
+    std::unordered_map<std::string, ExtractorHelpers::ExtractResult> m_done;
+    std::mutex                                                      m_mutex;
+    std::ofstream                                                   m_file;
+};
+
+// node summary as a flat JSON object, merged into one cluster report
+namespace BatchReport
+{
+    bool write(const std::string& path, const BatchStats& stats);
+    bool read(const std::string& path, BatchStats& stats);
+    std::string format(const BatchStats& stats);
+}
+
+#endif // SHARDPLAN_H
@@ -0,0 +1,119 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "syncbatcher.h"
+#include "platformfile.h"
+
+#include <set>
+
+SyncBatcher::SyncBatcher(size_t everyFiles, std::chrono::milliseconds interval)
+    : m_everyFiles(everyFiles)
+    , m_interval(interval)
+    , m_lastSync(std::chrono::steady_clock::now())
+    , m_group(0)
+    , m_failed(false)
+{
+}
+
+bool SyncBatcher::fileDone(const std::string& path)
+{
+    uint64_t group = 0;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (m_failed)
+        {
+            return false;
+        }
+        m_pending.push_back(path);
+        group = m_group;
+        if ((m_everyFiles == 0 || m_pending.size() < m_everyFiles)
+            && (m_interval.count() == 0 || std::chrono::steady_clock::now() - m_lastSync < m_interval))
+        {
+            return true;
+        }
+    }
+    // other workers keep finishing files meanwhile, they join this group
+    // if it's still pending once the previous sync is through
+    std::lock_guard<std::mutex> syncGuard(m_syncMutex);
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (m_group != group)
+        {
+            // another worker synced the group while we waited
+            return !m_failed;
+        }
+    }
+    return syncPending();
+}
+
+void SyncBatcher::whenSynced(const std::function<void(bool)>& action)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (!m_failed)
+        {
+            m_actions.push_back(action);
+            return;
+        }
+    }
+    action(false);
+}
+
+bool SyncBatcher::flush()
+{
+    std::lock_guard<std::mutex> syncGuard(m_syncMutex);
+    return syncPending();
+}
+
+bool SyncBatcher::syncPending()
+{
+    std::vector<std::string> group;
+    std::vector<std::function<void(bool)>> actions;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (m_failed)
+        {
+            return false;
+        }
+        group.swap(m_pending);
+        actions.swap(m_actions);
+        m_lastSync = std::chrono::steady_clock::now();
+        ++m_group;
+    }
+    // groups before this one were synced under the same lock
+    const bool synced = group.empty() || syncGroup(group);
+    if (!synced)
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_failed = true;
+        // actions queued meanwhile may stand for files of this group
+        actions.insert(actions.end(), m_actions.begin(), m_actions.end());
+        m_actions.clear();
+    }
+    for (const auto& action : actions)
+    {
+        action(synced);
+    }
+    return synced;
+}
+
+bool SyncBatcher::syncGroup(const std::vector<std::string>& paths)
+{
+    // the outputs of one sink share a file system, syncing it covers all
+    if (PlatformFile::syncFileSystem(paths.front()))
+    {
+        return true;
+    }
+    bool ok = true;
+    std::set<std::string> dirs;
+    for (const auto& path : paths)
+    {
+        ok = PlatformFile::syncPath(path) && ok;
+        dirs.insert(path.substr(0, path.find_last_of("/\\") + 1));
+    }
+    // and their names, outputs may have been renamed into place
+    for (const auto& dir : dirs)
+    {
+        ok = PlatformFile::syncDirectory(dir) && ok;
+    }
+    return ok;
+}
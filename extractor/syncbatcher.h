@@ -0,0 +1,53 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef SYNCBATCHER_H
+#define SYNCBATCHER_H
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+// Groups output syncs. An fsync per file would serialize the run on the
+// disk, so finished files are collected and the whole file system is
+// synced once per N files or once the interval has passed, whichever
+// comes first, plus once at the end. Where the platform can't sync a
+// file system the files of the group are flushed one by one instead.
+// Groups are synced one at a time, in the order they were closed. A
+// failed sync is final: the files finished around it can't be told apart
+// from the ones it lost, so nothing after it counts as synced either.
+class SyncBatcher
+{
+public:
+    // 0 disables that trigger
+    SyncBatcher(size_t everyFiles, std::chrono::milliseconds interval);
+
+    // path is complete; false once a sync has failed
+    bool fileDone(const std::string& path);
+    // Runs action(true) once every file finished so far is on disk, i.e.
+    // after the next group sync, action(false) if that sync failed. A
+    // checkpoint written this way never names an output a crash can lose.
+    void whenSynced(const std::function<void(bool)>& action);
+    // syncs whatever is pending and runs the actions waiting for it
+    bool flush();
+
+private:
+    // closes the pending group and syncs it, m_syncMutex held
+    bool syncPending();
+    static bool syncGroup(const std::vector<std::string>& paths);
+
+    std::mutex                              m_mutex;
+    std::mutex                              m_syncMutex;
+    size_t                                  m_everyFiles;
+    std::chrono::milliseconds               m_interval;
+    std::chrono::steady_clock::time_point   m_lastSync;
+    std::vector<std::string>                m_pending;
+    std::vector<std::function<void(bool)>>  m_actions;
+    // number of the pending group
+    uint64_t                                m_group;
+    bool                                    m_failed;
+};
+
+#endif // SYNCBATCHER_H
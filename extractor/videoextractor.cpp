@@ -0,0 +1,762 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "videoextractor.h"
+
+#include "hash.h"
+#include "readplanner.h"
+
+#include <heifreader.h>
+#include <heifboxes.h>
+#include <TinyEXIF.h>
+
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <map>
+#include <cctype>
+
+namespace
+{
+    bool check_extension(std::string const& img_file, std::string const& extension)
+    {
+        if (img_file.length() >= extension.length())
+        {
+            return (0 == img_file.compare(img_file.length() - extension.length(), extension.length(), extension));
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    std::string to_lower(const std::string& str)
+    {
+        std::string res;
+        res.resize(str.size());
+        std::transform(str.begin(), str.end(), res.begin(),
+                       [](unsigned char c) -> unsigned char { return std::tolower(c); });
+        return res;
+    }
+
+    // entry names become part of output file names
+    std::string sanitize_entry_name(const std::string& name)
+    {
+        std::string res = name.empty() ? std::string("entry") : name;
+        for (auto& c : res)
+        {
+            if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-' && c != '.')
+            {
+                c = '_';
+            }
+        }
+        return res;
+    }
+
+    // Copies the JPEG from SOI up to and including the SOS segment header.
+    bool read_jpeg_header(std::istream& fstream, std::vector<uint8_t>& header, size_t limit)
+    {
+        header.resize(2);
+        fstream.read(reinterpret_cast<char*>(&header[0]), 2);
+        if (!fstream || header[0] != 0xFF || header[1] != 0xD8)
+        {
+            return false;
+        }
+
+        while (header.size() < limit)
+        {
+            uint8_t marker[2];
+            fstream.read(reinterpret_cast<char*>(marker), 2);
+            // skip fill bytes in front of the marker code
+            while (fstream && marker[0] == 0xFF && marker[1] == 0xFF)
+            {
+                fstream.read(reinterpret_cast<char*>(&marker[1]), 1);
+            }
+            if (!fstream || marker[0] != 0xFF)
+            {
+                // not a marker, hand what we have to the parser
+                return true;
+            }
+            header.push_back(marker[0]);
+            header.push_back(marker[1]);
+
+            if (marker[1] == 0xD9)
+            {
+                return true;
+            }
+            // standalone markers carry no length
+            if (marker[1] == 0x01 || (marker[1] >= 0xD0 && marker[1] <= 0xD7))
+            {
+                continue;
+            }
+
+            uint8_t segLen[2];
+            fstream.read(reinterpret_cast<char*>(segLen), 2);
+            if (!fstream)
+            {
+                return true;
+            }
+            size_t segmentSize = (static_cast<size_t>(segLen[0]) << 8) | segLen[1];
+            if (segmentSize < 2)
+            {
+                return true;
+            }
+            size_t pos = header.size();
+            header.resize(pos + segmentSize);
+            header[pos] = segLen[0];
+            header[pos + 1] = segLen[1];
+            fstream.read(reinterpret_cast<char*>(&header[pos + 2]), segmentSize - 2);
+            if (static_cast<size_t>(fstream.gcount()) != segmentSize - 2)
+            {
+                header.resize(pos + 2 + static_cast<size_t>(fstream.gcount()));
+                return true;
+            }
+
+            if (marker[1] == 0xDA)
+            {
+                // start of scan, metadata segments are all behind us
+                return true;
+            }
+        }
+        return true;
+    }
+}
+
+VideoExtractor::VideoExtractor(OutputSink& sink, BufferPool& pool, const ExtractorHelpers::ExtractOptions& options)
+    : m_sink(sink)
+    , m_pool(pool)
+    , m_options(options)
+    , m_lastValidation(HeifHelpers::ValidationResult::Ok)
+    , m_lastReadRequests(0)
+    , m_wholeFileReader(nullptr)
+    , m_wholeFileGuard(nullptr)
+{
+}
+
+uint64_t VideoExtractor::lastReadRequests() const
+{
+    return m_lastReadRequests;
+}
+
+std::unique_ptr<HeifUtils::RangeReader> VideoExtractor::openReader(const std::string& inputPath)
+{
+    if (m_options.openReader)
+    {
+        return m_options.openReader(inputPath);
+    }
+    std::unique_ptr<HeifUtils::FileRangeReader> reader(new HeifUtils::FileRangeReader(inputPath));
+    if (!reader->isOpen())
+    {
+        return nullptr;
+    }
+    return std::move(reader);
+}
+
+HeifHelpers::ValidationResult VideoExtractor::lastValidation() const
+{
+    return m_lastValidation;
+}
+
+bool VideoExtractor::isSupported(const std::string& inputPath)
+{
+    std::string lower = to_lower(inputPath);
+    return check_extension(lower, ".jpg")
+        || check_extension(lower, ".jpeg")
+        || check_extension(lower, ".heic");
+}
+
+bool VideoExtractor::isHeic(const std::string& inputPath)
+{
+    return check_extension(to_lower(inputPath), ".heic");
+}
+
+std::string VideoExtractor::videoName(const std::string& inputPath, const std::string& extension)
+{
+    size_t slash = inputPath.find_last_of("/\\");
+    std::string name = (slash == std::string::npos) ? inputPath : inputPath.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos)
+    {
+        name.resize(dot);
+    }
+    return name + extension;
+}
+
+std::string VideoExtractor::outputName(const std::string& relativePath, const std::string& extension)
+{
+    std::string path = relativePath;
+    std::replace(path.begin(), path.end(), '\\', '/');
+    if (path.empty() || path[0] == '/' || (path.size() > 1 && path[1] == ':'))
+    {
+        return videoName(relativePath, extension);
+    }
+    std::string dir;
+    size_t start = 0;
+    for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', start))
+    {
+        const std::string part = path.substr(start, slash - start);
+        if (part == "..")
+        {
+            return videoName(relativePath, extension);
+        }
+        if (!part.empty() && part != ".")
+        {
+            dir += part + '/';
+        }
+        start = slash + 1;
+    }
+    return dir + videoName(path, extension);
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::extract(const std::string& inputPath, const std::string& namePath)
+{
+    m_lastValidation = HeifHelpers::ValidationResult::Ok;
+    m_lastReadRequests = 0;
+    if (!isSupported(inputPath))
+    {
+        return ExtractorHelpers::ExtractResult::UNSUPPORTED_FORMAT;
+    }
+    const std::string name = namePath.empty() ? inputPath.substr(inputPath.find_last_of("/\\") + 1) : namePath;
+
+    std::unique_ptr<HeifUtils::RangeReader> backend = openReader(inputPath);
+    if (!backend)
+    {
+        return ExtractorHelpers::ExtractResult::READ_ERROR;
+    }
+    ReadPlanner reader(*backend);
+    uint64_t wholeFileSize = 0;
+    if (m_options.wholeFileReadLimit
+        && backend->size() >= 0
+        && static_cast<uint64_t>(backend->size()) <= m_options.wholeFileReadLimit)
+    {
+        // the planner will hold the whole file, charge it to the budget
+        wholeFileSize = static_cast<uint64_t>(backend->size());
+        reader.setWholeFileLimit(m_options.wholeFileReadLimit);
+    }
+    BudgetGuard wholeFileGuard(m_pool.budget(), wholeFileSize);
+    if (wholeFileSize)
+    {
+        m_wholeFileReader = &reader;
+        m_wholeFileGuard = &wholeFileGuard;
+    }
+    else
+    {
+        // probes and small fetches
+        reader.setBudget(&m_pool.budget());
+    }
+
+    ExtractorHelpers::VideoLocation location;
+    ExtractorHelpers::MediaMetadata metadata;
+    ExtractorHelpers::MediaMetadata* wantedMetadata = m_options.metadata ? &metadata : nullptr;
+    std::vector<SefEntry> entries;
+    std::vector<SefEntry>* wantedEntries = (m_options.allSefEntries || !m_options.sefEntries.empty()) ? &entries : nullptr;
+    ExtractorHelpers::ExtractResult result = reader.prefetch()
+        ? locate(inputPath, reader, location, wantedMetadata, wantedEntries)
+        : ExtractorHelpers::ExtractResult::READ_ERROR;
+    if (result == ExtractorHelpers::ExtractResult::Ok)
+    {
+        result = transfer(inputPath, outputName(name), inputPath, reader, *backend, location, wantedMetadata);
+    }
+    // a photo without a motion clip may still carry the entries asked for
+    if (wantedEntries && (result == ExtractorHelpers::ExtractResult::Ok || result == ExtractorHelpers::ExtractResult::NO_VIDEO))
+    {
+        ExtractorHelpers::ExtractResult entriesResult = extractEntries(inputPath, name, reader, *backend, entries, location);
+        if (entriesResult != ExtractorHelpers::ExtractResult::Ok)
+        {
+            result = entriesResult;
+        }
+    }
+    m_wholeFileReader = nullptr;
+    m_wholeFileGuard = nullptr;
+    m_lastReadRequests = backend->requestCount();
+    return result;
+}
+
+void VideoExtractor::dropWholeFile()
+{
+    if (m_wholeFileReader)
+    {
+        m_wholeFileReader->setBudget(&m_pool.budget());
+        m_wholeFileGuard->release();
+        m_wholeFileReader = nullptr;
+        m_wholeFileGuard = nullptr;
+    }
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::extractEntries(const std::string& inputPath, const std::string& namePath,
+                                                               HeifUtils::RangeReader& reader, HeifUtils::RangeReader& backend,
+                                                               const std::vector<SefEntry>& entries,
+                                                               const ExtractorHelpers::VideoLocation& video)
+{
+    ExtractorHelpers::ExtractResult result = ExtractorHelpers::ExtractResult::Ok;
+    std::map<std::string, size_t> seen;
+    // sorted by offset, the reads move forward through the file
+    for (const auto& entry : entries)
+    {
+        // a name repeated in one file (several clips) gets a counter from the second on
+        const size_t occurrence = ++seen[entry.name];
+        if ((video.size && entry.offset == video.offset)
+            || entry.length == 0
+            || (!m_options.allSefEntries
+                && std::find(m_options.sefEntries.begin(), m_options.sefEntries.end(), entry.name) == m_options.sefEntries.end()))
+        {
+            continue;
+        }
+
+        std::string name = sanitize_entry_name(entry.name);
+        if (occurrence > 1)
+        {
+            name += "_" + std::to_string(occurrence);
+        }
+        ExtractorHelpers::VideoLocation location;
+        location.offset = entry.offset;
+        location.size = entry.length;
+        ExtractorHelpers::ExtractResult entryResult = transfer(inputPath, outputName(namePath, "_" + name + (entry.isVideo ? ".mp4" : ".bin")),
+                                                               inputPath, reader, backend, location, nullptr, entry.isVideo);
+        if (entryResult != ExtractorHelpers::ExtractResult::Ok && result == ExtractorHelpers::ExtractResult::Ok)
+        {
+            result = entryResult;
+        }
+    }
+    return result;
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::extractCompanion(const std::string& stillPath, const std::string& moviePath,
+                                                                 const std::string& namePath)
+{
+    m_lastValidation = HeifHelpers::ValidationResult::Ok;
+    m_lastReadRequests = 0;
+
+    ExtractorHelpers::MediaMetadata metadata;
+    ExtractorHelpers::MediaMetadata* wantedMetadata = m_options.metadata ? &metadata : nullptr;
+    if (wantedMetadata)
+    {
+        // capture time and location belong to the still, the clip has no video to locate in it
+        std::unique_ptr<HeifUtils::RangeReader> stillBackend = openReader(stillPath);
+        if (stillBackend)
+        {
+            ReadPlanner stillReader(*stillBackend);
+            stillReader.setBudget(&m_pool.budget());
+            ExtractorHelpers::VideoLocation unused;
+            if (stillReader.prefetch())
+            {
+                locate(stillPath, stillReader, unused, wantedMetadata);
+            }
+            m_lastReadRequests += stillBackend->requestCount();
+        }
+    }
+
+    std::unique_ptr<HeifUtils::RangeReader> backend = openReader(moviePath);
+    if (!backend || backend->size() <= 0)
+    {
+        return ExtractorHelpers::ExtractResult::READ_ERROR;
+    }
+    // the whole file is the video, read in one request with no probes
+    ReadPlanner reader(*backend);
+    reader.setBudget(&m_pool.budget());
+    ExtractorHelpers::VideoLocation location;
+    location.size = static_cast<uint64_t>(backend->size());
+
+    std::string extension = ".mov";
+    size_t dot = moviePath.find_last_of('.');
+    if (dot != std::string::npos && moviePath.find_first_of("/\\", dot) == std::string::npos)
+    {
+        extension = moviePath.substr(dot);
+    }
+    return transfer(stillPath, outputName(namePath.empty() ? stillPath.substr(stillPath.find_last_of("/\\") + 1) : namePath, extension),
+                    moviePath, reader, *backend, location, wantedMetadata);
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::transfer(const std::string& sourcePath, const std::string& entryName,
+                                                         const std::string& dataPath,
+                                                         HeifUtils::RangeReader& reader, HeifUtils::RangeReader& backend,
+                                                         const ExtractorHelpers::VideoLocation& location,
+                                                         ExtractorHelpers::MediaMetadata* metadata, bool isVideo)
+{
+    // the file read whole holds the video already, it's used in place
+    const uint8_t* data = m_wholeFileReader ? m_wholeFileReader->cached(location.offset, static_cast<size_t>(location.size)) : nullptr;
+    if (!data)
+    {
+        dropWholeFile();
+    }
+
+    // validation, dedup and the clip metadata need the video whole before it's written
+    if (!data && m_options.copyDepth && !m_options.openReader && !m_options.validate && !m_options.dedup && !metadata)
+    {
+        ExtractorHelpers::PayloadInfo info;
+        info.sourcePath = sourcePath;
+        info.entryName = entryName;
+        info.size = location.size;
+        std::unique_ptr<OutputStream> output = m_sink.openStream(info);
+        if (output)
+        {
+            return stream(info, *output, dataPath, reader, backend, location);
+        }
+    }
+
+    const size_t size = static_cast<size_t>(location.size);
+    BufferPool::Lease videoData;
+    Xxh64 xxh;
+    Sha256 sha;
+    // a dedup match stands on the SHA-256
+    bool sha256 = m_options.sha256 || m_options.dedup;
+    if (data)
+    {
+        xxh.update(data, size);
+        if (sha256)
+        {
+            sha.update(data, size);
+        }
+    }
+    else
+    {
+        videoData = m_pool.lease(size);
+        // one request for whatever part of the video the probes didn't bring,
+        // each chunk hashed as soon as it arrives
+        bool readOk = reader.readStream(location.offset, videoData.size(), videoData.data(), READ_CHUNK_SIZE,
+            [&](const uint8_t* chunk, size_t len) {
+                xxh.update(chunk, len);
+                if (sha256)
+                {
+                    sha.update(chunk, len);
+                }
+                return true;
+            });
+        m_lastReadRequests += backend.requestCount();
+        if (!readOk)
+        {
+            return ExtractorHelpers::ExtractResult::READ_ERROR;
+        }
+        data = videoData.data();
+    }
+
+    if (m_options.validate && isVideo)
+    {
+        Mp4Validator validator(data, size);
+        if (location.mdatSize)
+        {
+            validator.expectMdat(location.mdatOffset, location.mdatSize);
+        }
+        m_lastValidation = validator.validate();
+        if (m_lastValidation != HeifHelpers::ValidationResult::Ok)
+        {
+            return ExtractorHelpers::ExtractResult::INVALID_VIDEO;
+        }
+    }
+
+    if (metadata)
+    {
+        // moov is in the buffer already, no second pass over the clip
+        IsobmffWalker walker(data, size);
+        metadata->hasVideoInfo = HeifHelpers::readMp4Info(walker, metadata->video);
+    }
+
+    ExtractorHelpers::PayloadInfo info;
+    info.sourcePath = sourcePath;
+    info.entryName = entryName;
+    info.size = size;
+    info.xxh64 = xxh.hexDigest();
+    if (sha256)
+    {
+        info.sha256 = sha.hexDigest();
+    }
+    return store(info, data, metadata);
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::stream(ExtractorHelpers::PayloadInfo& info, OutputStream& output,
+                                                       const std::string& dataPath,
+                                                       HeifUtils::RangeReader& reader, HeifUtils::RangeReader& backend,
+                                                       const ExtractorHelpers::VideoLocation& location)
+{
+    // nothing records the digests, the bytes needn't pass through us at all
+    bool copied = false;
+    if (!m_options.manifest && !m_options.sha256)
+    {
+        PlatformFile input;
+        uint64_t done = 0;
+        if (input.open(dataPath, PlatformFile::OpenMode::READ_ONLY))
+        {
+            copied = output.copyFrom(input, location.offset, location.size, done);
+            if (!copied && done)
+            {
+                output.abort();
+                return ExtractorHelpers::ExtractResult::WRITE_ERROR;
+            }
+        }
+    }
+
+    if (!copied)
+    {
+        CopyPipeline pipeline(m_options.copyChunkSize, m_options.copyDepth);
+        BudgetGuard ringGuard(m_pool.budget(), pipeline.ringSize());
+        Xxh64 xxh;
+        Sha256 sha;
+        bool sha256 = m_options.sha256;
+        bool ok = pipeline.run(reader, location.offset, location.size,
+            [&](const uint8_t* chunk, size_t len) {
+                xxh.update(chunk, len);
+                if (sha256)
+                {
+                    sha.update(chunk, len);
+                }
+                return true;
+            },
+            [&](const uint8_t* chunk, size_t len) {
+                return output.write(chunk, len);
+            });
+        m_lastReadRequests += backend.requestCount();
+        if (!ok)
+        {
+            output.abort();
+            return pipeline.writeFailed() ? ExtractorHelpers::ExtractResult::WRITE_ERROR
+                                          : ExtractorHelpers::ExtractResult::READ_ERROR;
+        }
+        info.xxh64 = xxh.hexDigest();
+        if (sha256)
+        {
+            info.sha256 = sha.hexDigest();
+        }
+    }
+    else
+    {
+        m_lastReadRequests += backend.requestCount();
+    }
+
+    ExtractorHelpers::ManifestRecord record;
+    if (output.finish(info, record.output) != ExtractorHelpers::SinkResult::Ok)
+    {
+        return ExtractorHelpers::ExtractResult::WRITE_ERROR;
+    }
+    if (m_options.manifest)
+    {
+        record.payload = info;
+        if (!m_options.manifest->add(record))
+        {
+            return ExtractorHelpers::ExtractResult::WRITE_ERROR;
+        }
+    }
+    return ExtractorHelpers::ExtractResult::Ok;
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::store(ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                                      const ExtractorHelpers::MediaMetadata* metadata)
+{
+    ExtractorHelpers::ManifestRecord record;
+    ExtractorHelpers::OutputRef original;
+    ExtractorHelpers::SinkResult result = ExtractorHelpers::SinkResult::Ok;
+    if (m_options.dedup && m_options.dedup->find(info, original))
+    {
+        record.duplicate = true;
+        result = m_sink.writeDuplicate(info, data, original, record.output);
+    }
+    else
+    {
+        result = m_sink.write(info, data, record.output);
+        if (result == ExtractorHelpers::SinkResult::Ok && m_options.dedup)
+        {
+            m_options.dedup->add(info, record.output);
+        }
+    }
+
+    if (result == ExtractorHelpers::SinkResult::NAME_TAKEN)
+    {
+        return ExtractorHelpers::ExtractResult::NAME_TAKEN;
+    }
+    if (result != ExtractorHelpers::SinkResult::Ok)
+    {
+        return ExtractorHelpers::ExtractResult::WRITE_ERROR;
+    }
+
+    record.payload = info;
+    if (metadata)
+    {
+        record.metadata = *metadata;
+        if (m_sink.writeSidecar(record.output, Manifest::format(record) + "\n") != ExtractorHelpers::SinkResult::Ok)
+        {
+            return ExtractorHelpers::ExtractResult::WRITE_ERROR;
+        }
+    }
+    // the output is there, but an input missing from the manifest counts as failed
+    if (m_options.manifest && !m_options.manifest->add(record))
+    {
+        return ExtractorHelpers::ExtractResult::WRITE_ERROR;
+    }
+    return ExtractorHelpers::ExtractResult::Ok;
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::locate(const std::string& inputPath, HeifUtils::RangeReader& reader,
+                                                       ExtractorHelpers::VideoLocation& location,
+                                                       ExtractorHelpers::MediaMetadata* metadata,
+                                                       std::vector<SefEntry>* entries)
+{
+    if (!isSupported(inputPath))
+    {
+        return ExtractorHelpers::ExtractResult::UNSUPPORTED_FORMAT;
+    }
+
+    if (isHeic(inputPath))
+    {
+        return locateHeic(reader, location, metadata, entries);
+    }
+    return locateJpeg(reader, location, metadata, entries);
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::locateHeic(HeifUtils::RangeReader& reader, ExtractorHelpers::VideoLocation& location,
+                                                           ExtractorHelpers::MediaMetadata* metadata, std::vector<SefEntry>* entries)
+{
+    HeifReader heif;
+    heif.setSefdReadLimit(SEFD_PROBE_SIZE);
+    if (HeifHelpers::OperationResult::Ok != heif.load(reader))
+    {
+        return ExtractorHelpers::ExtractResult::READ_ERROR;
+    }
+    // the boxes heif (and sf, sharing them) hold until we return
+    BudgetGuard headerGuard(m_pool.budget(), heif.getHeldSize(), false);
+
+    SefdBox sf = heif.getSefdBox();
+    // with a directory the clip's range is known wherever it sits in the box
+    const SefEntry* clip = sf.hasDirectory() ? SefHelpers::findEntry(sf.getEntries(), "MotionPhoto_Data") : nullptr;
+    // sf holds the box copy until we return, so does the charge for it
+    std::unique_ptr<BudgetGuard> reloadGuard;
+    if (heif.isSefdTruncated() && (sf.getSize() == 0 || sf.getMdat().getSize() == 0) && !(clip && clip->isVideo))
+    {
+        // video isn't behind the first SEF fields, parse the whole box,
+        // charged to the budget as it's as large as the video itself
+        dropWholeFile();
+        reloadGuard.reset(new BudgetGuard(m_pool.budget(), heif.getSefdSize()));
+        HeifReader fullHeif;
+        HeifHelpers::OperationResult res = fullHeif.load(reader);
+        sf = fullHeif.getSefdBox();
+        if (HeifHelpers::OperationResult::Ok != res)
+        {
+            return ExtractorHelpers::ExtractResult::READ_ERROR;
+        }
+        clip = sf.hasDirectory() ? SefHelpers::findEntry(sf.getEntries(), "MotionPhoto_Data") : nullptr;
+    }
+    if (entries)
+    {
+        *entries = sf.getEntries();
+        for (auto& entry : *entries)
+        {
+            entry.offset += heif.getSefdOffset();
+        }
+    }
+
+    // collected before the video checks, a Live Photo still has no video of its own
+    if (metadata)
+    {
+        // the camera's UTC clock and the local EXIF time are kept apart
+        MediaMetadataHelpers::setUtcMilliseconds(sf.getImageUtcData(), *metadata);
+        uint64_t exifOffset = 0;
+        uint64_t exifLength = 0;
+        if (heif.getItemLocation("Exif", exifOffset, exifLength) && exifLength <= EXIF_ITEM_LIMIT)
+        {
+            // item data usually sits in the head probe, this costs no request
+            BudgetGuard exifGuard(m_pool.budget(), exifLength, false);
+            std::vector<uint8_t> exifItem(static_cast<size_t>(exifLength));
+            if (reader.read(exifOffset, exifItem.size(), exifItem.data()))
+            {
+                MediaMetadataHelpers::setFromExifItem(exifItem.data(), exifItem.size(), *metadata);
+            }
+        }
+    }
+
+    if (clip && clip->isVideo)
+    {
+        // exactly the clip, not the SEF entries and directory behind it
+        location.offset = heif.getSefdOffset() + clip->offset;
+        location.size = clip->length;
+        if (sf.getMdat().getSize() && sf.getFtypStartPos() == clip->offset)
+        {
+            location.mdatOffset = sf.getMdat().startPosition() - sf.getFtypStartPos();
+            location.mdatSize = sf.getMdat().endPosition();
+        }
+        return ExtractorHelpers::ExtractResult::Ok;
+    }
+
+    if (sf.getSize() == 0
+        || sf.getFtyp().getSize() == 0
+        || sf.getFtyp().GetMajorBand() != "mp42"
+        || sf.getMdat().getSize() == 0
+        || sf.getMdat().startPosition() == 0
+        || sf.getMdat().endPosition() == 0)
+    {
+        return ExtractorHelpers::ExtractResult::NO_VIDEO;
+    }
+
+    location.offset = heif.getSefdOffset() + sf.getFtypStartPos();
+    location.size = sf.getSize() - sf.getFtypStartPos();
+    // MdatBox::endPosition() is the payload length
+    location.mdatOffset = sf.getMdat().startPosition() - sf.getFtypStartPos();
+    location.mdatSize = sf.getMdat().endPosition();
+    return ExtractorHelpers::ExtractResult::Ok;
+}
+
+ExtractorHelpers::ExtractResult VideoExtractor::locateJpeg(HeifUtils::RangeReader& reader, ExtractorHelpers::VideoLocation& location,
+                                                           ExtractorHelpers::MediaMetadata* metadata, std::vector<SefEntry>* entries)
+{
+    int64_t size = reader.size();
+    if (size < 0)
+    {
+        return ExtractorHelpers::ExtractResult::READ_ERROR;
+    }
+    uint64_t length = static_cast<uint64_t>(size);
+    HeifUtils::RangeStreamBuf streamBuf(reader);
+    std::istream imgFile(&streamBuf);
+
+    // EXIF and XMP live in the APPn segments, the scan data and
+    // the appended video are never needed to find the video
+    std::vector<uint8_t> header;
+    if (!read_jpeg_header(imgFile, header, JPEG_HEADER_LIMIT))
+    {
+        return ExtractorHelpers::ExtractResult::READ_ERROR;
+    }
+    BudgetGuard headerGuard(m_pool.budget(), header.capacity(), false);
+
+    auto exif_info = TinyEXIF::EXIFInfo(header.data(), static_cast<unsigned>(header.size()));
+    if (!exif_info.Fields)
+    {
+        return ExtractorHelpers::ExtractResult::NO_VIDEO;
+    }
+    if (metadata)
+    {
+        MediaMetadataHelpers::setFromExif(exif_info, *metadata);
+    }
+
+    exif_info.parseFromXMPSegment(header.data(), static_cast<unsigned>(header.size()));
+    const bool xmpVideo = exif_info.MicroVideo.HasMicroVideo
+        && exif_info.MicroVideo.MicroVideoOffset != 0
+        && exif_info.MicroVideo.MicroVideoOffset <= length;
+    bool sefVideo = false;
+    if (!xmpVideo || entries)
+    {
+        // Samsung appends SEF data behind the image, its directory ends
+        // the file and sits in the tail probe
+        std::vector<SefEntry> sefEntries;
+        SefHelpers::readDirectory([&reader](uint64_t pos, size_t len, uint8_t* dst) { return reader.read(pos, len, dst); },
+                                  0, length, sefEntries);
+        const SefEntry* clip = SefHelpers::findEntry(sefEntries, "MotionPhoto_Data");
+        if (!xmpVideo && clip && clip->isVideo)
+        {
+            location.offset = clip->offset;
+            location.size = clip->length;
+            sefVideo = true;
+        }
+        if (entries)
+        {
+            entries->swap(sefEntries);
+        }
+    }
+    if (sefVideo)
+    {
+        return ExtractorHelpers::ExtractResult::Ok;
+    }
+    if (!xmpVideo)
+    {
+        return ExtractorHelpers::ExtractResult::NO_VIDEO;
+    }
+
+    location.offset = length - exif_info.MicroVideo.MicroVideoOffset;
+    location.size = exif_info.MicroVideo.MicroVideoOffset;
+    return ExtractorHelpers::ExtractResult::Ok;
+}
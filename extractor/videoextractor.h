@@ -0,0 +1,151 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef VIDEOEXTRACTOR_H
+#define VIDEOEXTRACTOR_H
+
+#include <outputsink.h>
+#include <memorybudget.h>
+#include <isobmff.h>
+#include <dedupindex.h>
+#include <manifest.h>
+#include <metadata.h>
+#include <rangereader.h>
+#include <copypipeline.h>
+#include <sefdirectory.h>
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ReadPlanner;
+
+namespace ExtractorHelpers
+{
+    enum class ExtractResult : int
+    {
+        Ok = 0,
+        UNSUPPORTED_FORMAT,
+        READ_ERROR,
+        NO_VIDEO,
+        WRITE_ERROR,
+        INVALID_VIDEO,
+        NAME_TAKEN,         // another input's output already has the name
+    };
+
+    // where the embedded video lives in the input file
+    struct VideoLocation
+    {
+        uint64_t    offset = 0;
+        uint64_t    size = 0;
+        // mdat payload relative to the video start, when the container tells it
+        uint64_t    mdatOffset = 0;
+        uint64_t    mdatSize = 0;
+    };
+
+    struct ExtractOptions
+    {
+        bool        validate = false;       // check the video structure before writing
+        bool        sha256 = false;         // XXH64 is always computed
+        // capture time, location and clip properties into the manifest and a sidecar per video
+        bool        metadata = false;
+        DedupIndex* dedup = nullptr;        // reference already written payloads, implies sha256
+        Manifest*   manifest = nullptr;
+        // inputs up to this size are read in one sequential request
+        uint64_t    wholeFileReadLimit = 0;
+        // input backend, a local file when not set
+        std::function<std::unique_ptr<HeifUtils::RangeReader>(const std::string&)> openReader;
+        // Local videos that don't have to be held whole (no validation,
+        // dedup or clip metadata) are copied by the kernel when it can,
+        // else through the read/write pipeline; depth 0 turns both off.
+        size_t      copyChunkSize = CopyPipeline::DEFAULT_CHUNK_SIZE;
+        size_t      copyDepth = CopyPipeline::DEFAULT_DEPTH;
+        // Samsung SEF entries stored beside the video from the same parse,
+        // as "<photo>_<entry>.mp4" for clips and "<photo>_<entry>.bin" else
+        std::vector<std::string> sefEntries;
+        bool        allSefEntries = false;
+    };
+}
+
+class VideoExtractor
+{
+public:
+    // how much of the sefd box / JPEG header is read to find the video
+    static const size_t SEFD_PROBE_SIZE = 64 * 1024;
+    static const size_t JPEG_HEADER_LIMIT = 4 * 1024 * 1024;
+    // payload is read and hashed in pieces of this size, while still in cache
+    static const size_t READ_CHUNK_SIZE = 1024 * 1024;
+    // a HEIF Exif item is a few KB, larger ones aren't worth a read
+    static const size_t EXIF_ITEM_LIMIT = 1024 * 1024;
+
+    VideoExtractor(OutputSink& sink, BufferPool& pool, const ExtractorHelpers::ExtractOptions& options);
+
+    HeifHelpers::ValidationResult lastValidation() const;
+    // requests the last extract() sent to the input backend
+    uint64_t lastReadRequests() const;
+
+    // outputs are named after namePath (see outputName), the file name of
+    // inputPath when it's empty
+    ExtractorHelpers::ExtractResult extract(const std::string& inputPath, const std::string& namePath = std::string());
+    // The video lives in a file of its own (Apple Live Photo): the whole
+    // movie is stored as the still's video, with the still's metadata.
+    ExtractorHelpers::ExtractResult extractCompanion(const std::string& stillPath, const std::string& moviePath,
+                                                     const std::string& namePath = std::string());
+    // reads headers only, the video size is known before its payload is touched;
+    // the photo metadata and the SEF entries (file offsets) found in those
+    // headers are collected on the way
+    ExtractorHelpers::ExtractResult locate(const std::string& inputPath, HeifUtils::RangeReader& reader,
+                                           ExtractorHelpers::VideoLocation& location,
+                                           ExtractorHelpers::MediaMetadata* metadata = nullptr,
+                                           std::vector<SefEntry>* entries = nullptr);
+
+    static bool isSupported(const std::string& inputPath);
+    static bool isHeic(const std::string& inputPath);
+    // "dir/IMG_0001.heic" -> "IMG_0001.mp4"
+    static std::string videoName(const std::string& inputPath, const std::string& extension = ".mp4");
+    // "a/IMG_0001.heic" -> "a/IMG_0001.mp4", so the output tree mirrors the
+    // input tree; absolute paths and paths with ".." keep only the file name
+    static std::string outputName(const std::string& relativePath, const std::string& extension = ".mp4");
+
+private:
+    std::unique_ptr<HeifUtils::RangeReader> openReader(const std::string& inputPath);
+    ExtractorHelpers::ExtractResult locateHeic(HeifUtils::RangeReader& reader, ExtractorHelpers::VideoLocation& location,
+                                               ExtractorHelpers::MediaMetadata* metadata, std::vector<SefEntry>* entries);
+    ExtractorHelpers::ExtractResult locateJpeg(HeifUtils::RangeReader& reader, ExtractorHelpers::VideoLocation& location,
+                                               ExtractorHelpers::MediaMetadata* metadata, std::vector<SefEntry>* entries);
+
+    // reads, hashes, checks and stores the located video; dataPath is the file holding it,
+    // payloads that aren't videos skip the validation
+    ExtractorHelpers::ExtractResult transfer(const std::string& sourcePath, const std::string& entryName,
+                                             const std::string& dataPath,
+                                             HeifUtils::RangeReader& reader, HeifUtils::RangeReader& backend,
+                                             const ExtractorHelpers::VideoLocation& location,
+                                             ExtractorHelpers::MediaMetadata* metadata, bool isVideo = true);
+    // stores the requested SEF entries other than the video
+    ExtractorHelpers::ExtractResult extractEntries(const std::string& inputPath, const std::string& namePath,
+                                                   HeifUtils::RangeReader& reader, HeifUtils::RangeReader& backend,
+                                                   const std::vector<SefEntry>& entries,
+                                                   const ExtractorHelpers::VideoLocation& video);
+    // transfer() without holding the video: kernel copy or pipeline
+    ExtractorHelpers::ExtractResult stream(ExtractorHelpers::PayloadInfo& info, OutputStream& output,
+                                           const std::string& dataPath,
+                                           HeifUtils::RangeReader& reader, HeifUtils::RangeReader& backend,
+                                           const ExtractorHelpers::VideoLocation& location);
+    ExtractorHelpers::ExtractResult store(ExtractorHelpers::PayloadInfo& info, const uint8_t* data,
+                                          const ExtractorHelpers::MediaMetadata* metadata);
+    // frees the file extract() holds whole and its budget charge, before
+    // anything else is acquired: a worker must never wait on its own bytes
+    void dropWholeFile();
+
+    OutputSink&                     m_sink;
+    BufferPool&                     m_pool;
+    ExtractorHelpers::ExtractOptions m_options;
+    HeifHelpers::ValidationResult   m_lastValidation;
+    uint64_t                        m_lastReadRequests;
+    // set while extract() holds the input whole
+    ReadPlanner*                    m_wholeFileReader;
+    BudgetGuard*                    m_wholeFileGuard;
+};
+
+#endif // VIDEOEXTRACTOR_H
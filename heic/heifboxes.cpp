@@ -163,6 +163,49 @@ uint64_t SefdBox::getFtypStartPos()
     return m_ftypStartPos;
 }
 
+const std::string& SefdBox::getImageUtcData() const
+{
+    return m_imageUtcData;
+}
+
+void SefdBox::parseDirectory(const SefHelpers::ReadAt& readBeyond)
+{
+    if (!m_size || !m_boxMemory)
+    {
+        return;
+    }
+    std::shared_ptr<HeifUtils::RamData> memory = m_boxMemory;
+    SefHelpers::ReadAt readAt = [&](uint64_t pos, size_t len, uint8_t* dst) {
+        if (pos + len > memory->getSize())
+        {
+            return readBeyond(pos, len, dst);
+        }
+        memory->setPosition(static_cast<int64_t>(pos));
+        return memory->FileStreamRead(dst, static_cast<int>(len)) == static_cast<int>(len);
+    };
+    // The SEF data starts right after the 8 byte box header: what
+    // parseHeaderFull reads as version and flags is the [u16 0][u16 type]
+    // of the first block. Blocks are found by their distance back from
+    // the directory at the box end, dataStart only bounds them.
+    const uint64_t dataStart = 8;
+    std::vector<SefEntry> entries;
+    if (SefHelpers::readDirectory(readAt, dataStart, m_size, entries))
+    {
+        m_entries.swap(entries);
+        m_hasDirectory = true;
+    }
+}
+
+bool SefdBox::hasDirectory() const
+{
+    return m_hasDirectory;
+}
+
+const std::vector<SefEntry>& SefdBox::getEntries() const
+{
+    return m_entries;
+}
+
 void SefdBox::parseHeaderFull()
 {
     parseHeaders();
@@ -218,11 +261,20 @@ void SefdBox::parseSefd()
             m_ftypStartPos = currentPos;
             m_boxMemory->setPosition(currentPos);
             m_ftyp = FtypBox(m_boxMemory);
+            if (!m_entries.empty() && m_entries.back().offset == currentPos)
+            {
+                m_entries.back().isVideo = true;
+            }
         }
         else if (box.getType() == "mdat")
         {
             m_boxMemory->setPosition(currentPos);
             m_mdat = MdatBox(m_boxMemory);
+            if (static_cast<uint64_t>(m_boxMemory->getPosition()) != currentPos + m_mdat.getSize())
+            {
+                // mdat runs past the data we hold (truncated read), nothing to parse behind it
+                break;
+            }
         }
         else
         {
@@ -262,17 +314,33 @@ void SefdBox::fillPropertyData(std::string& pdata)
 
 void SefdBox::fillPropertyByType(std::string& ptype)
 {
+    SefEntry entry;
+    entry.name = ptype;
+    entry.offset = static_cast<uint64_t>(m_boxMemory->getPosition());
     if (ptype == "Image_UTC_Data")
     {
         fillPropertyData(m_imageUtcData);
+        // without the terminator
+        entry.length = m_imageUtcData.empty() ? 0 : m_imageUtcData.size() - 1;
     }
     else if (ptype == "MCC_Data") // nothing realy interesting
     {
         fillPropertyData(m_imageMCCData);
+        entry.length = m_imageMCCData.empty() ? 0 : m_imageMCCData.size() - 1;
     }
     else if (ptype == "MotionPhoto_Data")
     {
         m_motionPhotoDataFound = true;
+        // the rest of the box, nothing tells where the video ends
+        entry.length = m_size > entry.offset ? m_size - entry.offset : 0;
+    }
+    else
+    {
+        return;
+    }
+    if (m_size)
+    {
+        m_entries.push_back(entry);
     }
 }
 
@@ -2,6 +2,8 @@
 
 #ifndef HEIFBOXES_H
 #define HEIFBOXES_H
+#include <sefdirectory.h>
+
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -82,6 +84,16 @@ public:
     FtypBox& getFtyp();
     MdatBox& getMdat();
     uint64_t getFtypStartPos();
+    // capture time as written by the camera, milliseconds since the epoch
+    const std::string& getImageUtcData() const;
+
+    // Reads the SEF directory at the end of the box. Box bytes beyond the
+    // ones held (see HeifReader::setSefdReadLimit) come from readBeyond.
+    void parseDirectory(const SefHelpers::ReadAt& readBeyond);
+    bool hasDirectory() const;
+    // offsets from the box start; every entry when the directory was read,
+    // else the fields the sequential parse understood
+    const std::vector<SefEntry>& getEntries() const;
 
 private:
     void parseHeaderFull();
@@ -90,6 +102,7 @@ private:
     void fillPropertyData(std::string& pdata);
 
     bool        m_motionPhotoDataFound = false;
+    bool        m_hasDirectory = false;
     uint8_t     m_version = 0;
     uint32_t    m_flags = 0; // only 24 bit can be set
     uint64_t    m_ftypStartPos;
@@ -98,5 +111,6 @@ private:
     std::string m_imageMCCData;
     FtypBox     m_ftyp;
     MdatBox     m_mdat;
+    std::vector<SefEntry> m_entries;
 };
 #endif // HEIFBOXES_H
@@ -6,7 +6,7 @@
 
 namespace
 {
-    bool stream_can_be_read(std::ifstream& fstream)
+    bool stream_can_be_read(std::istream& fstream)
     {
         char buffer;
         auto prev_pos = fstream.tellg();
@@ -22,12 +22,12 @@ namespace
         }
     }
 
-    void readToBuffer(std::ifstream& fstream, char* buffer, size_t buffer_size)
+    void readToBuffer(std::istream& fstream, char* buffer, size_t buffer_size)
     {
         fstream.read(buffer, buffer_size);
     }
 
-    HeifHelpers::OperationResult readBytes(std::ifstream& fstream, int64_t count, std::int64_t& boxSize)
+    HeifHelpers::OperationResult readBytes(std::istream& fstream, int64_t count, std::int64_t& boxSize)
     {
         int64_t value = 0;
         for (unsigned int i = 0; i < count; ++i)
@@ -52,18 +52,40 @@ HeifReader::HeifReader()
     : m_readerState(ReaderState::UNINITIALIZED)
     , m_streamLength(0)
     , m_sefdOffset(0)
+    , m_sefdSize(0)
+    , m_sefdReadLimit(0)
+    , m_sefdTruncated(false)
+    , m_sefdHeld(0)
     , m_sefd()
+    , m_meta()
 {
 
 }
 
+void HeifReader::setSefdReadLimit(size_t limit)
+{
+    m_sefdReadLimit = limit;
+}
+
+bool HeifReader::isSefdTruncated() const
+{
+    return m_sefdTruncated;
+}
+
 HeifHelpers::OperationResult HeifReader::load(const char* img_path)
 {
     std::shared_ptr<std::ifstream> imgFile(new std::ifstream(img_path, std::ifstream::in | std::ifstream::binary), [](std::ifstream* p) {if (p) { p->close(), delete p; }});
     return load(*imgFile.get());
 }
 
-HeifHelpers::OperationResult HeifReader::load(std::ifstream& fstream)
+HeifHelpers::OperationResult HeifReader::load(HeifUtils::RangeReader& reader)
+{
+    HeifUtils::RangeStreamBuf streamBuf(reader);
+    std::istream stream(&streamBuf);
+    return load(stream);
+}
+
+HeifHelpers::OperationResult HeifReader::load(std::istream& fstream)
 {
     if (!fstream || fstream.bad())
     {
@@ -93,7 +115,6 @@ HeifHelpers::OperationResult HeifReader::load(std::ifstream& fstream)
             {
                 if (boxType == "ftyp"
                     || boxType == "etyp"
-                    || boxType == "meta"
                     || boxType == "moov"
                     || boxType == "moof"
                     || boxType == "mdat"
@@ -104,6 +125,10 @@ HeifHelpers::OperationResult HeifReader::load(std::ifstream& fstream)
                     result = skipBox(fstream);
                 }
 
+                else if (boxType == "meta")
+                {
+                    result = handleMeta(fstream);
+                }
                 else if (boxType == "sefd")
                 {
                     result = handleSefd(fstream);
@@ -125,7 +150,7 @@ HeifHelpers::OperationResult HeifReader::load(std::ifstream& fstream)
     return result;
 }
 
-HeifHelpers::OperationResult HeifReader::readBoxParameters(std::ifstream& fstream, const std::int64_t fstream_size, std::string& boxType, std::int64_t& boxSize)
+HeifHelpers::OperationResult HeifReader::readBoxParameters(std::istream& fstream, const std::int64_t fstream_size, std::string& boxType, std::int64_t& boxSize)
 {
     const std::int64_t start_location = fstream.tellg();
 
@@ -179,8 +204,29 @@ size_t HeifReader::getSefdOffset()
     return m_sefdOffset;
 }
 
+size_t HeifReader::getSefdSize()
+{
+    return m_sefdSize;
+}
+
+bool HeifReader::getItemLocation(const std::string& itemType, uint64_t& offset, uint64_t& length) const
+{
+    // a meta box we can't follow only costs the metadata, never the video
+    IsobmffWalker walker(m_meta.data(), m_meta.size());
+    IsobmffBox meta;
+    return walker.readBox(0, m_meta.size(), meta)
+        && HeifHelpers::findItemLocation(walker, meta, itemType, offset, length)
+        && offset < m_streamLength
+        && length <= m_streamLength - offset;
+}
 
-HeifHelpers::OperationResult HeifReader::skipBox(std::ifstream& fstream)
+size_t HeifReader::getHeldSize() const
+{
+    return m_meta.size() + m_sefdHeld;
+}
+
+
+HeifHelpers::OperationResult HeifReader::skipBox(std::istream& fstream)
 {
     const std::int64_t start_location = fstream.tellg();
 
@@ -201,24 +247,39 @@ HeifHelpers::OperationResult HeifReader::skipBox(std::ifstream& fstream)
 }
 
 
-HeifHelpers::OperationResult HeifReader::handleSefd(std::ifstream& fstream)
+HeifHelpers::OperationResult HeifReader::handleSefd(std::istream& fstream)
 {
     std::vector<uint8_t> boxDataRaw;
     m_sefdOffset = fstream.tellg();
-    HeifHelpers::OperationResult result = readBox(fstream, boxDataRaw);
+    HeifHelpers::OperationResult result = readBox(fstream, boxDataRaw, m_sefdReadLimit, &m_sefdTruncated);
+    // RamData takes the vector over
+    m_sefdHeld = boxDataRaw.size();
     std::shared_ptr<HeifUtils::RamData> boxData(new HeifUtils::RamData(boxDataRaw));
 
     if (result != HeifHelpers::OperationResult::Ok)
     {
         return result;
     }
+    m_sefdSize = static_cast<size_t>(static_cast<std::int64_t>(fstream.tellg()) - static_cast<std::int64_t>(m_sefdOffset));
 
     m_sefd = SefdBox(boxData);
 
+    // the directory closes the box, past a truncated read it costs one
+    // small read near the file end, where the tail probe usually is
+    const std::streampos boxEnd = fstream.tellg();
+    const size_t sefdOffset = m_sefdOffset;
+    m_sefd.parseDirectory([&fstream, sefdOffset](uint64_t pos, size_t len, uint8_t* dst) {
+        fstream.seekg(static_cast<std::streamoff>(sefdOffset + pos));
+        fstream.read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(len));
+        return fstream && static_cast<size_t>(fstream.gcount()) == len;
+    });
+    fstream.clear();
+    fstream.seekg(boxEnd);
+
     return HeifHelpers::OperationResult::Ok;
 }
 
-HeifHelpers::OperationResult HeifReader::readBox(std::ifstream& fstream, std::vector<uint8_t>& bitstream)
+HeifHelpers::OperationResult HeifReader::handleMeta(std::istream& fstream)
 {
     std::string boxType;
     std::int64_t boxSize = 0;
@@ -227,13 +288,47 @@ HeifHelpers::OperationResult HeifReader::readBox(std::ifstream& fstream, std::ve
     {
         return result;
     }
+    if (boxSize > META_READ_LIMIT)
+    {
+        return skipBox(fstream);
+    }
+
+    return readBox(fstream, m_meta);
+}
 
-    bitstream.resize(static_cast<size_t>(boxSize));
-    fstream.read(reinterpret_cast<char*>(&bitstream[0]), boxSize);
+HeifHelpers::OperationResult HeifReader::readBox(std::istream& fstream, std::vector<uint8_t>& bitstream, size_t maxBytes, bool* truncated)
+{
+    std::string boxType;
+    std::int64_t boxSize = 0;
+    HeifHelpers::OperationResult result = readBoxParameters(fstream, m_streamLength, boxType, boxSize);
+    if (result != HeifHelpers::OperationResult::Ok)
+    {
+        return result;
+    }
+
+    const std::int64_t start_location = fstream.tellg();
+    std::int64_t readSize = boxSize;
+    if (truncated)
+    {
+        *truncated = false;
+    }
+    if (maxBytes != 0 && readSize > static_cast<std::int64_t>(maxBytes))
+    {
+        readSize = static_cast<std::int64_t>(maxBytes);
+        if (truncated)
+        {
+            *truncated = true;
+        }
+    }
+
+    bitstream.resize(static_cast<size_t>(readSize));
+    fstream.read(reinterpret_cast<char*>(&bitstream[0]), readSize);
     if (fstream.bad())
     {
         return HeifHelpers::OperationResult::FILE_READ_ERROR;
     }
+    // keep the stream at the box end, as a full read would
+    fstream.seekg(start_location + boxSize);
 
     return HeifHelpers::OperationResult::Ok;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #define HEIFREADER_H
 
 #include <heifboxes.h>
+#include <rangereader.h>
+#include <isobmff.h>
 
 #include <fstream>
 #include <vector>
@@ -27,16 +29,35 @@ class HeifReader
 public:
     HeifReader();
 
+    // Caps how much of the sefd box is copied to memory, 0 means the whole box.
+    // The embedded video normally follows a few small SEF fields, so a short
+    // prefix is enough to locate it without holding the video twice.
+    void setSefdReadLimit(size_t limit);
+    bool isSefdTruncated() const;
+
     HeifHelpers::OperationResult load(const char* img_path);
-    HeifHelpers::OperationResult load(std::ifstream& fstream);
-    HeifHelpers::OperationResult readBoxParameters(std::ifstream& fstream, const std::int64_t fstream_size, std::string& boxType, std::int64_t& boxSize);
+    HeifHelpers::OperationResult load(std::istream& fstream);
+    HeifHelpers::OperationResult load(HeifUtils::RangeReader& reader);
+    HeifHelpers::OperationResult readBoxParameters(std::istream& fstream, const std::int64_t fstream_size, std::string& boxType, std::int64_t& boxSize);
+    // SefdBox::getEntries() offsets are relative to getSefdOffset()
     SefdBox getSefdBox();
     size_t  getSefdOffset();
+    // whole box, however much of it was read
+    size_t  getSefdSize();
+    // file range of the first item of a type ("Exif", "mime" for XMP),
+    // looked up in the meta box kept from load()
+    bool    getItemLocation(const std::string& itemType, uint64_t& offset, uint64_t& length) const;
+    // bytes load() keeps in memory: the meta box and the sefd box as read
+    size_t  getHeldSize() const;
 
 private:
-    HeifHelpers::OperationResult skipBox(std::ifstream& fstream);
-    HeifHelpers::OperationResult handleSefd(std::ifstream& fstream);
-    HeifHelpers::OperationResult readBox(std::ifstream& fstream, std::vector<uint8_t>& bitstream);
+    HeifHelpers::OperationResult skipBox(std::istream& fstream);
+    HeifHelpers::OperationResult handleSefd(std::istream& fstream);
+    HeifHelpers::OperationResult handleMeta(std::istream& fstream);
+    HeifHelpers::OperationResult readBox(std::istream& fstream, std::vector<uint8_t>& bitstream, size_t maxBytes = 0, bool* truncated = nullptr);
+
+    // item tables are a few KB, anything bigger isn't worth holding
+    static const int64_t META_READ_LIMIT = 1024 * 1024;
 
     enum class ReaderState
     {
@@ -48,7 +69,12 @@ private:
     ReaderState     m_readerState;
     size_t          m_streamLength;
     size_t          m_sefdOffset;
+    size_t          m_sefdSize;
+    size_t          m_sefdReadLimit;
+    bool            m_sefdTruncated;
+    size_t          m_sefdHeld;
     SefdBox         m_sefd;
+    std::vector<uint8_t> m_meta;
 };
 
 #endif // HEIFREADER_H
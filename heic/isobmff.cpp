@@ -0,0 +1,493 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "isobmff.h"
+
+namespace
+{
+    bool is_box_type(const uint8_t* type)
+    {
+        // four printable characters, what every registered box type is made of
+        for (int i = 0; i < 4; ++i)
+        {
+            if (type[i] < 0x20 || type[i] > 0x7e)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_container(const std::string& type)
+    {
+        return type == "moov"
+            || type == "trak"
+            || type == "mdia"
+            || type == "minf"
+            || type == "stbl";
+    }
+}
+
+namespace HeifHelpers
+{
+    const char* validationMessage(ValidationResult result)
+    {
+        switch (result)
+        {
+        case ValidationResult::Ok:
+            return "ok";
+        case ValidationResult::TRUNCATED:
+            return "video is truncated";
+        case ValidationResult::BAD_BOX_SIZE:
+            return "inconsistent box size";
+        case ValidationResult::NO_MOOV:
+            return "no moov box";
+        case ValidationResult::NO_MDAT:
+            return "no mdat box";
+        case ValidationResult::MDAT_MISMATCH:
+            return "mdat doesn't match the container";
+        case ValidationResult::CHUNK_OUTSIDE_MDAT:
+            return "chunk offset outside of mdat";
+        }
+        return "unknown";
+    }
+}
+
+IsobmffWalker::IsobmffWalker(const uint8_t* data, uint64_t size)
+    : m_data(data)
+    , m_size(size)
+{
+}
+
+uint16_t IsobmffWalker::readU16(uint64_t pos) const
+{
+    return static_cast<uint16_t>((m_data[pos] << 8) | m_data[pos + 1]);
+}
+
+uint32_t IsobmffWalker::readU32(uint64_t pos) const
+{
+    const uint8_t* p = m_data + pos;
+    return (static_cast<uint32_t>(p[0]) << 24)
+        | (static_cast<uint32_t>(p[1]) << 16)
+        | (static_cast<uint32_t>(p[2]) << 8)
+        | static_cast<uint32_t>(p[3]);
+}
+
+uint64_t IsobmffWalker::readU64(uint64_t pos) const
+{
+    return (static_cast<uint64_t>(readU32(pos)) << 32) | readU32(pos + 4);
+}
+
+uint64_t IsobmffWalker::readUint(uint64_t pos, unsigned bytes) const
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < bytes; ++i)
+    {
+        value = (value << 8) | m_data[pos + i];
+    }
+    return value;
+}
+
+const uint8_t* IsobmffWalker::data() const
+{
+    return m_data;
+}
+
+uint64_t IsobmffWalker::size() const
+{
+    return m_size;
+}
+
+bool IsobmffWalker::readBox(uint64_t pos, uint64_t limit, IsobmffBox& box) const
+{
+    if (limit > m_size || pos > limit || limit - pos < 8)
+    {
+        return false;
+    }
+    if (!is_box_type(m_data + pos + 4))
+    {
+        return false;
+    }
+
+    box.offset = pos;
+    box.type.assign(reinterpret_cast<const char*>(m_data + pos + 4), 4);
+    box.headerSize = 8;
+    box.size = readU32(pos);
+
+    if (box.size == 1)
+    {
+        if (limit - pos < 16)
+        {
+            return false;
+        }
+        box.size = readU64(pos + 8);
+        box.headerSize = 16;
+    }
+    else if (box.size == 0)
+    {
+        // box extends to the end of its parent
+        box.size = limit - pos;
+    }
+
+    if (box.type == "uuid")
+    {
+        box.headerSize += 16;
+    }
+
+    return box.size >= box.headerSize && box.size <= limit - pos;
+}
+
+bool IsobmffWalker::runsPastEnd(uint64_t pos) const
+{
+    if (pos > m_size || m_size - pos < 8 || !is_box_type(m_data + pos + 4))
+    {
+        return false;
+    }
+    uint64_t declared = readU32(pos);
+    if (declared == 1 && m_size - pos >= 16)
+    {
+        declared = readU64(pos + 8);
+    }
+    return declared > m_size - pos;
+}
+
+bool IsobmffWalker::children(uint64_t begin, uint64_t end, std::vector<IsobmffBox>& boxes) const
+{
+    uint64_t pos = begin;
+    while (pos < end)
+    {
+        IsobmffBox box;
+        if (!readBox(pos, end, box))
+        {
+            return false;
+        }
+        boxes.push_back(box);
+        pos = box.end();
+    }
+    return true;
+}
+
+bool IsobmffWalker::findChild(const IsobmffBox& parent, const std::string& type, IsobmffBox& child) const
+{
+    std::vector<IsobmffBox> boxes;
+    children(parent.payloadOffset(), parent.end(), boxes);
+    for (const auto& box : boxes)
+    {
+        if (box.type == type)
+        {
+            child = box;
+            return true;
+        }
+    }
+    return false;
+}
+
+Mp4Validator::Mp4Validator(const uint8_t* data, uint64_t size)
+    : m_walker(data, size)
+    , m_hasExpectedMdat(false)
+    , m_expectedMdatOffset(0)
+    , m_expectedMdatSize(0)
+{
+}
+
+void Mp4Validator::expectMdat(uint64_t payloadOffset, uint64_t payloadSize)
+{
+    m_hasExpectedMdat = true;
+    m_expectedMdatOffset = payloadOffset;
+    m_expectedMdatSize = payloadSize;
+}
+
+HeifHelpers::ValidationResult Mp4Validator::validate()
+{
+    m_mdatRanges.clear();
+    std::vector<IsobmffBox> moovs;
+
+    uint64_t pos = 0;
+    const uint64_t end = m_walker.size();
+    while (pos < end)
+    {
+        IsobmffBox box;
+        if (!m_walker.readBox(pos, end, box))
+        {
+            if (!moovs.empty() && !m_mdatRanges.empty())
+            {
+                // the movie is complete, what follows isn't ISOBMFF
+                // (the Samsung SEF directory trails the video in sefd)
+                break;
+            }
+            if (end - pos < 8 || m_walker.runsPastEnd(pos))
+            {
+                return HeifHelpers::ValidationResult::TRUNCATED;
+            }
+            return HeifHelpers::ValidationResult::BAD_BOX_SIZE;
+        }
+
+        if (box.type == "moov")
+        {
+            moovs.push_back(box);
+        }
+        else if (box.type == "mdat")
+        {
+            m_mdatRanges.emplace_back(box.payloadOffset(), box.end());
+        }
+        pos = box.end();
+    }
+
+    if (m_mdatRanges.empty())
+    {
+        return HeifHelpers::ValidationResult::NO_MDAT;
+    }
+    if (moovs.empty())
+    {
+        return HeifHelpers::ValidationResult::NO_MOOV;
+    }
+
+    if (m_hasExpectedMdat
+        && (m_mdatRanges.front().first != m_expectedMdatOffset
+            || m_mdatRanges.front().second - m_mdatRanges.front().first != m_expectedMdatSize))
+    {
+        return HeifHelpers::ValidationResult::MDAT_MISMATCH;
+    }
+
+    for (const auto& moov : moovs)
+    {
+        HeifHelpers::ValidationResult result = checkChunkOffsets(moov);
+        if (result != HeifHelpers::ValidationResult::Ok)
+        {
+            return result;
+        }
+    }
+    return HeifHelpers::ValidationResult::Ok;
+}
+
+HeifHelpers::ValidationResult Mp4Validator::checkChunkOffsets(const IsobmffBox& box)
+{
+    if (is_container(box.type))
+    {
+        std::vector<IsobmffBox> boxes;
+        if (!m_walker.children(box.payloadOffset(), box.end(), boxes))
+        {
+            return HeifHelpers::ValidationResult::BAD_BOX_SIZE;
+        }
+        for (const auto& child : boxes)
+        {
+            HeifHelpers::ValidationResult result = checkChunkOffsets(child);
+            if (result != HeifHelpers::ValidationResult::Ok)
+            {
+                return result;
+            }
+        }
+        return HeifHelpers::ValidationResult::Ok;
+    }
+
+    if (box.type != "stco" && box.type != "co64")
+    {
+        return HeifHelpers::ValidationResult::Ok;
+    }
+
+    // full box: version/flags, entry count, entries
+    const uint64_t entrySize = (box.type == "stco") ? 4 : 8;
+    const uint64_t entriesPos = box.payloadOffset() + 8;
+    if (box.size < box.headerSize + 8)
+    {
+        return HeifHelpers::ValidationResult::BAD_BOX_SIZE;
+    }
+    const uint64_t count = m_walker.readU32(box.payloadOffset() + 4);
+    if (count > (box.end() - entriesPos) / entrySize)
+    {
+        return HeifHelpers::ValidationResult::BAD_BOX_SIZE;
+    }
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t chunkOffset = (entrySize == 4)
+            ? m_walker.readU32(entriesPos + i * 4)
+            : m_walker.readU64(entriesPos + i * 8);
+        bool inside = false;
+        for (const auto& mdat : m_mdatRanges)
+        {
+            if (chunkOffset >= mdat.first && chunkOffset < mdat.second)
+            {
+                inside = true;
+                break;
+            }
+        }
+        if (!inside)
+        {
+            return HeifHelpers::ValidationResult::CHUNK_OUTSIDE_MDAT;
+        }
+    }
+    return HeifHelpers::ValidationResult::Ok;
+}
+
+namespace HeifHelpers
+{
+    bool readMp4Info(const IsobmffWalker& walker, Mp4Info& info)
+    {
+        IsobmffBox root;
+        root.size = walker.size();
+        IsobmffBox moov;
+        if (!walker.findChild(root, "moov", moov))
+        {
+            return false;
+        }
+
+        IsobmffBox mvhd;
+        if (!walker.findChild(moov, "mvhd", mvhd))
+        {
+            return false;
+        }
+        // full box, then creation and modification times sized by version
+        const uint64_t p = mvhd.payloadOffset();
+        const bool v1 = (mvhd.end() > p) && walker.data()[p] == 1;
+        if (mvhd.end() - p < (v1 ? 32 : 20))
+        {
+            return false;
+        }
+        info.timescale = walker.readU32(p + (v1 ? 20 : 12));
+        info.duration = v1 ? walker.readU64(p + 24) : walker.readU32(p + 16);
+
+        std::vector<IsobmffBox> tracks;
+        walker.children(moov.payloadOffset(), moov.end(), tracks);
+        for (const auto& trak : tracks)
+        {
+            IsobmffBox mdia, hdlr, minf, stbl, stsd, entry;
+            if (trak.type != "trak"
+                || !walker.findChild(trak, "mdia", mdia)
+                || !walker.findChild(mdia, "hdlr", hdlr)
+                || hdlr.end() - hdlr.payloadOffset() < 12)
+            {
+                continue;
+            }
+            // version/flags, pre_defined, handler_type
+            if (std::string(reinterpret_cast<const char*>(walker.data() + hdlr.payloadOffset() + 8), 4) != "vide")
+            {
+                continue;
+            }
+            // version/flags and entry count precede the sample entries
+            if (walker.findChild(mdia, "minf", minf)
+                && walker.findChild(minf, "stbl", stbl)
+                && walker.findChild(stbl, "stsd", stsd)
+                && walker.readBox(stsd.payloadOffset() + 8, stsd.end(), entry))
+            {
+                info.videoCodec = entry.type;
+            }
+            break;
+        }
+        return true;
+    }
+
+    bool findItemLocation(const IsobmffWalker& walker, const IsobmffBox& meta, const std::string& itemType,
+                          uint64_t& offset, uint64_t& length)
+    {
+        // meta is a full box, its children follow version/flags
+        IsobmffBox content = meta;
+        content.headerSize += 4;
+        IsobmffBox iinf, iloc;
+        if (content.size < content.headerSize
+            || !walker.findChild(content, "iinf", iinf)
+            || !walker.findChild(content, "iloc", iloc))
+        {
+            return false;
+        }
+
+        uint64_t pos = iinf.payloadOffset();
+        if (iinf.end() - pos < 6)
+        {
+            return false;
+        }
+        pos += (walker.data()[pos] == 0) ? 6 : 8;
+        std::vector<IsobmffBox> entries;
+        walker.children(pos, iinf.end(), entries);
+
+        bool found = false;
+        uint32_t itemId = 0;
+        for (const auto& infe : entries)
+        {
+            // item info entries before version 2 carry no item type
+            const uint64_t p = infe.payloadOffset();
+            if (infe.type != "infe" || infe.end() - p < 4 || walker.data()[p] < 2)
+            {
+                continue;
+            }
+            const bool wideId = walker.data()[p] >= 3;
+            const uint64_t typePos = p + 4 + (wideId ? 4 : 2) + 2;
+            if (typePos + 4 > infe.end())
+            {
+                continue;
+            }
+            if (std::string(reinterpret_cast<const char*>(walker.data() + typePos), 4) == itemType)
+            {
+                itemId = wideId ? walker.readU32(p + 4) : walker.readU16(p + 4);
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            return false;
+        }
+
+        pos = iloc.payloadOffset();
+        const uint64_t end = iloc.end();
+        if (end - pos < 6)
+        {
+            return false;
+        }
+        const uint8_t version = walker.data()[pos];
+        const unsigned offsetSize = walker.data()[pos + 4] >> 4;
+        const unsigned lengthSize = walker.data()[pos + 4] & 0x0F;
+        const unsigned baseOffsetSize = walker.data()[pos + 5] >> 4;
+        const unsigned indexSize = (version == 1 || version == 2) ? (walker.data()[pos + 5] & 0x0F) : 0;
+        pos += 6;
+
+        auto take = [&](unsigned bytes, uint64_t& value) -> bool {
+            if (end - pos < bytes)
+            {
+                return false;
+            }
+            value = walker.readUint(pos, bytes);
+            pos += bytes;
+            return true;
+        };
+
+        uint64_t itemCount = 0;
+        if (!take(version < 2 ? 2 : 4, itemCount))
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < itemCount; ++i)
+        {
+            uint64_t id = 0, constructionMethod = 0, dataReference = 0, baseOffset = 0, extentCount = 0;
+            if (!take(version < 2 ? 2 : 4, id)
+                || ((version == 1 || version == 2) && !take(2, constructionMethod))
+                || !take(2, dataReference)
+                || !take(baseOffsetSize, baseOffset)
+                || !take(2, extentCount))
+            {
+                return false;
+            }
+            for (uint64_t e = 0; e < extentCount; ++e)
+            {
+                uint64_t extentIndex = 0, extentOffset = 0, extentLength = 0;
+                if (!take(indexSize, extentIndex)
+                    || !take(offsetSize, extentOffset)
+                    || !take(lengthSize, extentLength))
+                {
+                    return false;
+                }
+                // first extent only, Exif and XMP items are never split
+                if (id == itemId && e == 0)
+                {
+                    if ((constructionMethod & 0x0F) != 0 || dataReference != 0 || extentLength == 0)
+                    {
+                        return false;
+                    }
+                    offset = baseOffset + extentOffset;
+                    length = extentLength;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+}
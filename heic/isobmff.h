@@ -0,0 +1,105 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef ISOBMFF_H
+#define ISOBMFF_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace HeifHelpers
+{
+    enum class ValidationResult : int
+    {
+        Ok = 0,
+        TRUNCATED,
+        BAD_BOX_SIZE,
+        NO_MOOV,
+        NO_MDAT,
+        MDAT_MISMATCH,
+        CHUNK_OUTSIDE_MDAT,
+    };
+
+    const char* validationMessage(ValidationResult result);
+}
+
+struct IsobmffBox
+{
+    std::string type;
+    uint64_t    offset = 0;     // of the box header
+    uint64_t    headerSize = 0;
+    uint64_t    size = 0;       // whole box, header included
+
+    uint64_t payloadOffset() const { return offset + headerSize; }
+    uint64_t end() const { return offset + size; }
+};
+
+// Box walker over an in-memory ISOBMFF range, the same header rules as
+// HeifBoxBase::parseHeaders (32/64 bit sizes, uuid) but bounds checked
+// and without copying the data.
+class IsobmffWalker
+{
+public:
+    IsobmffWalker(const uint8_t* data, uint64_t size);
+
+    // reads the box header at pos, the box must end before limit
+    bool readBox(uint64_t pos, uint64_t limit, IsobmffBox& box) const;
+    // a well formed header whose size goes beyond the data
+    bool runsPastEnd(uint64_t pos) const;
+    // direct children of a container payload, stops at the first bad header
+    bool children(uint64_t begin, uint64_t end, std::vector<IsobmffBox>& boxes) const;
+    bool findChild(const IsobmffBox& parent, const std::string& type, IsobmffBox& child) const;
+
+    uint16_t readU16(uint64_t pos) const;
+    uint32_t readU32(uint64_t pos) const;
+    uint64_t readU64(uint64_t pos) const;
+    // big endian field of 0, 2, 4 or 8 bytes, as iloc sizes them
+    uint64_t readUint(uint64_t pos, unsigned bytes) const;
+    const uint8_t* data() const;
+    uint64_t size() const;
+
+private:
+    const uint8_t*  m_data;
+    uint64_t        m_size;
+};
+
+// Structural check of an extracted MP4 without decoding it: top-level
+// boxes must fit the range, moov and mdat must be there and every
+// stco/co64 chunk offset must land inside an mdat payload.
+class Mp4Validator
+{
+public:
+    Mp4Validator(const uint8_t* data, uint64_t size);
+
+    // mdat payload position known from the container, checked when set
+    void expectMdat(uint64_t payloadOffset, uint64_t payloadSize);
+    HeifHelpers::ValidationResult validate();
+
+private:
+    HeifHelpers::ValidationResult checkChunkOffsets(const IsobmffBox& box);
+
+    IsobmffWalker                               m_walker;
+    bool                                        m_hasExpectedMdat;
+    uint64_t                                    m_expectedMdatOffset;
+    uint64_t                                    m_expectedMdatSize;
+    std::vector<std::pair<uint64_t, uint64_t>>  m_mdatRanges;
+};
+
+// movie properties read from moov, the samples are never touched
+struct Mp4Info
+{
+    uint32_t    timescale = 0;
+    uint64_t    duration = 0;       // in timescale units
+    std::string videoCodec;         // sample entry of the first video track: "hvc1", "avc1"...
+};
+
+namespace HeifHelpers
+{
+    bool readMp4Info(const IsobmffWalker& walker, Mp4Info& info);
+    // File range of the first item of itemType ("Exif", "mime"...) that
+    // a HEIF meta box describes, only items stored in the file itself.
+    bool findItemLocation(const IsobmffWalker& walker, const IsobmffBox& meta, const std::string& itemType,
+                          uint64_t& offset, uint64_t& length);
+}
+
+#endif // ISOBMFF_H
@@ -0,0 +1,195 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "rangereader.h"
+
+#include <algorithm>
+
+namespace HeifUtils
+{
+    RangeReader::RangeReader()
+        : m_requests(0)
+        , m_bytes(0)
+    {
+    }
+
+    bool RangeReader::readStream(uint64_t offset, size_t len, uint8_t* dst, size_t chunkSize, const ChunkCallback& onChunk)
+    {
+        if (!read(offset, len, dst))
+        {
+            return false;
+        }
+        for (size_t pos = 0; pos < len; pos += chunkSize)
+        {
+            size_t chunk = (len - pos < chunkSize) ? len - pos : chunkSize;
+            if (!onChunk(dst + pos, chunk))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint64_t RangeReader::requestCount() const
+    {
+        return m_requests;
+    }
+
+    uint64_t RangeReader::bytesFetched() const
+    {
+        return m_bytes;
+    }
+
+    FileRangeReader::FileRangeReader(const std::string& path)
+        : m_file(path.c_str(), std::ifstream::in | std::ifstream::binary)
+        , m_size(-1)
+    {
+        if (m_file.is_open())
+        {
+            m_file.seekg(0, std::ios::end);
+            m_size = static_cast<int64_t>(m_file.tellg());
+            m_file.seekg(0, std::ios::beg);
+        }
+    }
+
+    bool FileRangeReader::isOpen() const
+    {
+        return m_file.is_open() && m_size >= 0;
+    }
+
+    int64_t FileRangeReader::size()
+    {
+        return m_size;
+    }
+
+    bool FileRangeReader::read(uint64_t offset, size_t len, uint8_t* dst)
+    {
+        ++m_requests;
+        m_file.clear();
+        m_file.seekg(offset);
+        m_file.read(reinterpret_cast<char*>(dst), len);
+        m_bytes += static_cast<uint64_t>(m_file.gcount());
+        return !m_file.bad() && static_cast<size_t>(m_file.gcount()) == len;
+    }
+
+    bool FileRangeReader::readStream(uint64_t offset, size_t len, uint8_t* dst, size_t chunkSize, const ChunkCallback& onChunk)
+    {
+        ++m_requests;
+        m_file.clear();
+        m_file.seekg(offset);
+        for (size_t pos = 0; pos < len; pos += chunkSize)
+        {
+            size_t chunk = (len - pos < chunkSize) ? len - pos : chunkSize;
+            m_file.read(reinterpret_cast<char*>(dst + pos), chunk);
+            m_bytes += static_cast<uint64_t>(m_file.gcount());
+            if (m_file.bad() || static_cast<size_t>(m_file.gcount()) != chunk || !onChunk(dst + pos, chunk))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    RangeStreamBuf::RangeStreamBuf(RangeReader& reader)
+        : m_reader(reader)
+        , m_buffer(BUFFER_SIZE)
+        , m_bufferPos(0)
+    {
+        setg(&m_buffer[0], &m_buffer[0], &m_buffer[0]);
+    }
+
+    RangeStreamBuf::int_type RangeStreamBuf::underflow()
+    {
+        if (gptr() < egptr())
+        {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        uint64_t pos = m_bufferPos + static_cast<uint64_t>(gptr() - eback());
+        int64_t total = m_reader.size();
+        if (total < 0 || pos >= static_cast<uint64_t>(total))
+        {
+            return traits_type::eof();
+        }
+
+        size_t len = BUFFER_SIZE;
+        if (static_cast<uint64_t>(total) - pos < len)
+        {
+            len = static_cast<size_t>(static_cast<uint64_t>(total) - pos);
+        }
+        if (!m_reader.read(pos, len, reinterpret_cast<uint8_t*>(&m_buffer[0])))
+        {
+            return traits_type::eof();
+        }
+        m_bufferPos = pos;
+        setg(&m_buffer[0], &m_buffer[0], &m_buffer[0] + len);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize RangeStreamBuf::xsgetn(char* s, std::streamsize n)
+    {
+        std::streamsize buffered = egptr() - gptr();
+        if (n <= static_cast<std::streamsize>(BUFFER_SIZE) || n <= buffered)
+        {
+            return std::streambuf::xsgetn(s, n);
+        }
+
+        // large reads skip the buffer and go to the reader as one request
+        std::copy(gptr(), egptr(), s);
+        uint64_t pos = m_bufferPos + static_cast<uint64_t>(egptr() - eback());
+        int64_t total = m_reader.size();
+        std::streamsize wanted = n - buffered;
+        if (total < 0 || pos >= static_cast<uint64_t>(total))
+        {
+            setg(eback(), egptr(), egptr());
+            return buffered;
+        }
+        if (static_cast<uint64_t>(total) - pos < static_cast<uint64_t>(wanted))
+        {
+            wanted = static_cast<std::streamsize>(static_cast<uint64_t>(total) - pos);
+        }
+        if (!m_reader.read(pos, static_cast<size_t>(wanted), reinterpret_cast<uint8_t*>(s + buffered)))
+        {
+            setg(eback(), egptr(), egptr());
+            return buffered;
+        }
+        m_bufferPos = pos + static_cast<uint64_t>(wanted);
+        setg(&m_buffer[0], &m_buffer[0], &m_buffer[0]);
+        return buffered + wanted;
+    }
+
+    RangeStreamBuf::pos_type RangeStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+    {
+        int64_t base = 0;
+        if (dir == std::ios_base::cur)
+        {
+            base = static_cast<int64_t>(m_bufferPos) + (gptr() - eback());
+        }
+        else if (dir == std::ios_base::end)
+        {
+            base = m_reader.size();
+        }
+        return seekpos(pos_type(base + off), which);
+    }
+
+    RangeStreamBuf::pos_type RangeStreamBuf::seekpos(pos_type pos, std::ios_base::openmode)
+    {
+        int64_t target = static_cast<int64_t>(pos);
+        if (target < 0 || target > m_reader.size())
+        {
+            return pos_type(off_type(-1));
+        }
+
+        uint64_t utarget = static_cast<uint64_t>(target);
+        if (utarget >= m_bufferPos && utarget <= m_bufferPos + static_cast<uint64_t>(egptr() - eback()))
+        {
+            // still inside the buffered window
+            setg(eback(), eback() + (utarget - m_bufferPos), egptr());
+        }
+        else
+        {
+            m_bufferPos = utarget;
+            setg(&m_buffer[0], &m_buffer[0], &m_buffer[0]);
+        }
+        return pos;
+    }
+}
@@ -0,0 +1,77 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef RANGEREADER_H
+#define RANGEREADER_H
+
+#include <stdint.h>
+#include <fstream>
+#include <functional>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace HeifUtils
+{
+    // Random access to an input by byte ranges. Every read is one request
+    // to the backing store, which for object stores means one round trip.
+    class RangeReader
+    {
+    public:
+        typedef std::function<bool(const uint8_t* data, size_t len)> ChunkCallback;
+
+        RangeReader();
+        virtual ~RangeReader() {}
+
+        // object stores report it with the first response, so it's free
+        virtual int64_t size() = 0;
+        virtual bool read(uint64_t offset, size_t len, uint8_t* dst) = 0;
+        // one request for [offset, offset + len), onChunk sees the data
+        // in chunkSize pieces as they arrive; returning false aborts
+        virtual bool readStream(uint64_t offset, size_t len, uint8_t* dst, size_t chunkSize, const ChunkCallback& onChunk);
+
+        uint64_t requestCount() const;
+        uint64_t bytesFetched() const;
+
+    protected:
+        uint64_t    m_requests;
+        uint64_t    m_bytes;
+    };
+
+    class FileRangeReader : public RangeReader
+    {
+    public:
+        FileRangeReader(const std::string& path);
+
+        bool isOpen() const;
+        int64_t size() override;
+        bool read(uint64_t offset, size_t len, uint8_t* dst) override;
+        bool readStream(uint64_t offset, size_t len, uint8_t* dst, size_t chunkSize, const ChunkCallback& onChunk) override;
+
+    private:
+        std::ifstream   m_file;
+        int64_t         m_size;
+    };
+
+    // Seekable std::streambuf over a RangeReader, lets the stream based
+    // box parsing run on any range source.
+    class RangeStreamBuf : public std::streambuf
+    {
+    public:
+        static const size_t BUFFER_SIZE = 16 * 1024;
+
+        RangeStreamBuf(RangeReader& reader);
+
+    protected:
+        int_type underflow() override;
+        std::streamsize xsgetn(char* s, std::streamsize n) override;
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+    private:
+        RangeReader&        m_reader;
+        std::vector<char>   m_buffer;
+        uint64_t            m_bufferPos;    // file offset of m_buffer[0]
+    };
+}
+
+#endif // RANGEREADER_H
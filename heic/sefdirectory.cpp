@@ -0,0 +1,127 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#include "sefdirectory.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+    const size_t SEF_TRAILER_SIZE = 8;          // directory length and "SEFT"
+    const size_t SEF_HEADER_SIZE = 12;          // "SEFH", version, count
+    const size_t SEF_DIRECTORY_ENTRY_SIZE = 12;
+    const size_t SEF_BLOCK_HEADER_SIZE = 8;
+    // a directory of a few dozen entries is a few hundred bytes
+    const uint32_t SEF_DIRECTORY_LIMIT = 64 * 1024;
+    const uint32_t SEF_NAME_LIMIT = 1024;
+
+    uint16_t le16(const uint8_t* p)
+    {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    uint32_t le32(const uint8_t* p)
+    {
+        return static_cast<uint32_t>(p[0])
+            | (static_cast<uint32_t>(p[1]) << 8)
+            | (static_cast<uint32_t>(p[2]) << 16)
+            | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    bool read_block(const SefHelpers::ReadAt& readAt, uint64_t blockPos, uint32_t blockLength, SefEntry& entry)
+    {
+        uint8_t header[SEF_BLOCK_HEADER_SIZE];
+        if (!readAt(blockPos, sizeof(header), header))
+        {
+            return false;
+        }
+        const uint32_t nameLength = le32(header + 4);
+        if (nameLength > SEF_NAME_LIMIT || nameLength > blockLength - SEF_BLOCK_HEADER_SIZE)
+        {
+            return false;
+        }
+        entry.offset = blockPos + SEF_BLOCK_HEADER_SIZE + nameLength;
+        entry.length = blockLength - SEF_BLOCK_HEADER_SIZE - nameLength;
+
+        // the name and the start of the data in one read
+        const size_t probe = entry.length < 8 ? static_cast<size_t>(entry.length) : 8;
+        std::vector<uint8_t> tail(nameLength + probe);
+        if (!tail.empty() && !readAt(blockPos + SEF_BLOCK_HEADER_SIZE, tail.size(), tail.data()))
+        {
+            return false;
+        }
+        entry.name.assign(reinterpret_cast<const char*>(tail.data()), nameLength);
+        // some writers count the terminator in the name
+        while (!entry.name.empty() && entry.name.back() == '\0')
+        {
+            entry.name.pop_back();
+        }
+        entry.isVideo = probe == 8 && memcmp(&tail[nameLength + 4], "ftyp", 4) == 0;
+        return true;
+    }
+}
+
+bool SefHelpers::readDirectory(const ReadAt& readAt, uint64_t begin, uint64_t end, std::vector<SefEntry>& entries)
+{
+    if (end < begin || end - begin < SEF_HEADER_SIZE + SEF_TRAILER_SIZE)
+    {
+        return false;
+    }
+    uint8_t trailer[SEF_TRAILER_SIZE];
+    if (!readAt(end - SEF_TRAILER_SIZE, sizeof(trailer), trailer) || memcmp(trailer + 4, "SEFT", 4) != 0)
+    {
+        return false;
+    }
+    const uint32_t directoryLength = le32(trailer);
+    if (directoryLength < SEF_HEADER_SIZE
+        || directoryLength > SEF_DIRECTORY_LIMIT
+        || directoryLength > end - begin - SEF_TRAILER_SIZE)
+    {
+        return false;
+    }
+    const uint64_t directoryPos = end - SEF_TRAILER_SIZE - directoryLength;
+    std::vector<uint8_t> directory(directoryLength);
+    if (!readAt(directoryPos, directory.size(), directory.data()) || memcmp(directory.data(), "SEFH", 4) != 0)
+    {
+        return false;
+    }
+    const uint32_t count = le32(&directory[8]);
+    if (count > (directoryLength - SEF_HEADER_SIZE) / SEF_DIRECTORY_ENTRY_SIZE)
+    {
+        return false;
+    }
+
+    entries.clear();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const uint8_t* item = &directory[SEF_HEADER_SIZE + i * SEF_DIRECTORY_ENTRY_SIZE];
+        const uint32_t distance = le32(item + 4);
+        const uint32_t blockLength = le32(item + 8);
+        // a block lies between the data start and the directory
+        if (distance > directoryPos - begin || blockLength < SEF_BLOCK_HEADER_SIZE || blockLength > distance)
+        {
+            continue;
+        }
+        SefEntry entry;
+        entry.type = le16(item + 2);
+        if (read_block(readAt, directoryPos - distance, blockLength, entry))
+        {
+            entries.push_back(entry);
+        }
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const SefEntry& a, const SefEntry& b) { return a.offset < b.offset; });
+    return true;
+}
+
+const SefEntry* SefHelpers::findEntry(const std::vector<SefEntry>& entries, const std::string& name)
+{
+    for (const auto& entry : entries)
+    {
+        if (entry.name == name)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,42 @@
+// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
+
+#ifndef SEFDIRECTORY_H
+#define SEFDIRECTORY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+// One entry of Samsung's SEF data, the payload of a HEIC sefd box or the
+// trailer of a JPEG. Every entry is a block
+//     [u16 0][u16 type][u32 name length][name][data]
+// and a directory closes the data:
+//     "SEFH" u32 version, u32 count,
+//     count x ([u16 0][u16 type][u32 distance from the block to "SEFH"][u32 block length]),
+//     u32 directory length, "SEFT"
+// all little endian.
+struct SefEntry
+{
+    uint16_t    type = 0;
+    std::string name;           // "MotionPhoto_Data", "Image_UTC_Data"...
+    uint64_t    offset = 0;     // of the data, in the coordinates the reader was given
+    uint64_t    length = 0;
+    bool        isVideo = false; // data is an MP4, it starts with ftyp
+};
+
+namespace SefHelpers
+{
+    // reads len bytes at pos into dst, false when they aren't there
+    typedef std::function<bool(uint64_t pos, size_t len, uint8_t* dst)> ReadAt;
+
+    // Parses the directory of the SEF data in [begin, end), entries come
+    // back sorted by offset. False when there is no directory; entries
+    // that point outside the data are dropped.
+    bool readDirectory(const ReadAt& readAt, uint64_t begin, uint64_t end, std::vector<SefEntry>& entries);
+
+    // first entry of that name, null when missing
+    const SefEntry* findEntry(const std::vector<SefEntry>& entries, const std::string& name);
+}
+
+#endif // SEFDIRECTORY_H
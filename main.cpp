@@ -1,25 +1,41 @@
 ﻿// Copyright © 2021 Smbat Makiyan (a.k.a. idimus, a.k.a. simfeo). All rights reserved.
 
-#include <heifreader.h>
-#include <heifboxes.h>
+#include <videoextractor.h>
+#include <outputsink.h>
+#include <memorybudget.h>
+#include <batchrunner.h>
+#include <dedupindex.h>
+#include <manifest.h>
+#include <readplanner.h>
+#include <shardplan.h>
+#include <ioorder.h>
+#include <livephoto.h>
+#include <platformfile.h>
+#include <syncbatcher.h>
 
-#include <TinyEXIF.h>
 #include <argparse.hpp>
 
 #include <iostream>
-#include <fstream>
+#include <limits>
 #include <string>
-#include <algorithm>
+#include <memory>
+#include <thread>
 
 
-bool check_extension(std::string const& img_file, std::string const& extension)
+bool read_number(ArgumentParser& parser, const std::string& name, uint64_t& value)
 {
-    if (img_file.length() >= extension.length())
+    if (!parser.count(name))
     {
-        return (0 == img_file.compare(img_file.length() - extension.length(), extension.length(), extension));
+        return true;
     }
-    else
+    try
+    {
+        value = std::stoull(parser.retrieve<std::string>(name));
+        return true;
+    }
+    catch (const std::exception&)
     {
+        std::cerr << "--" << name << " expects a number" << std::endl;
         return false;
     }
 }
@@ -30,6 +46,31 @@ int main(int argc, char** argv)
 
     parser.addArgument("-i", "--input", 1);
     parser.addArgument("-o", "--output", 1);
+    parser.addArgument("-l", "--list", 1);
+    parser.addArgument("-j", "--jobs", 1);
+    parser.addArgument("--memory-budget", 1);
+    parser.addArgument("--pack");
+    parser.addArgument("--validate");
+    parser.addArgument("--sha256");
+    parser.addArgument("--dedup");
+    parser.addArgument("--manifest", 1);
+    parser.addArgument("--metadata");
+    parser.addArgument("--simulate-latency", 1);
+    parser.addArgument("--root", 1);
+    parser.addArgument("--shard", 1);
+    parser.addArgument("--checkpoint", 1);
+    parser.addArgument("--report", 1);
+    parser.addArgument("--merge-reports", '+');
+    parser.addArgument("--io-order", 1);
+    parser.addArgument("--live-photos");
+    parser.addArgument("--copy-chunk", 1);
+    parser.addArgument("--copy-depth", 1);
+    parser.addArgument("--preallocate");
+    parser.addArgument("--atomic-rename");
+    parser.addArgument("--sync-every", 1);
+    parser.addArgument("--sync-interval", 1);
+    parser.addArgument("--direct-io", 1);
+    parser.addArgument("--sef-entries", '+');
     parser.addArgument("--help");
     //parser.addArgument("--license");
 
@@ -70,112 +111,364 @@ int main(int argc, char** argv)
     //    return 0;
     //}
 
-    if (!parser.count("input") || !parser.count("output"))
+    if (parser.count("merge-reports"))
+    {
+        BatchStats total;
+        for (const auto& report : parser.retrieve<std::vector<std::string>>("merge-reports"))
+        {
+            if (!BatchReport::read(report, total))
+            {
+                std::cerr << "cannot read report " << report << std::endl;
+                return 3;
+            }
+        }
+        if (parser.count("report") && !BatchReport::write(parser.retrieve<std::string>("report"), total))
+        {
+            std::cerr << "cannot write report" << std::endl;
+            return 5;
+        }
+        std::cout << BatchReport::format(total) << std::endl;
+        return 0;
+    }
+
+    if ((!parser.count("input") && !parser.count("list")) || !parser.count("output"))
     {
         std::cerr << "you should specify both input and output files" << std::endl;
         std::cout << parser.usage() << std::endl;
         return 2;
     }
 
-    std::string input_file = parser.retrieve<std::string>("input");
+    uint64_t jobs = std::thread::hardware_concurrency();
+    uint64_t memory_budget_mb = 1024;
+    uint64_t latency_ms = 0;
+    uint64_t copy_chunk_kb = CopyPipeline::DEFAULT_CHUNK_SIZE / 1024;
+    uint64_t copy_depth = CopyPipeline::DEFAULT_DEPTH;
+    uint64_t sync_every = 0;
+    uint64_t sync_interval_s = 0;
+    uint64_t direct_io_mb = 0;
+    if (!read_number(parser, "jobs", jobs)
+        || !read_number(parser, "memory-budget", memory_budget_mb)
+        || !read_number(parser, "simulate-latency", latency_ms)
+        || !read_number(parser, "copy-chunk", copy_chunk_kb)
+        || !read_number(parser, "copy-depth", copy_depth)
+        || !read_number(parser, "sync-every", sync_every)
+        || !read_number(parser, "sync-interval", sync_interval_s)
+        || !read_number(parser, "direct-io", direct_io_mb))
+    {
+        return 2;
+    }
+    if (copy_chunk_kb == 0)
+    {
+        std::cerr << "--copy-chunk expects a size in KiB" << std::endl;
+        return 2;
+    }
+    if (jobs == 0)
+    {
+        jobs = 1;
+    }
+
+    if (memory_budget_mb > std::numeric_limits<uint64_t>::max() / (1024 * 1024))
+    {
+        std::cerr << "--memory-budget is too large" << std::endl;
+        return 2;
+    }
+
     std::string output_file = parser.retrieve<std::string>("output");
-    std::string input_file_lower;
-    input_file_lower.resize(input_file.size());
-    std::transform(input_file.begin(), input_file.end(), input_file_lower.begin(), 
-                                       [](unsigned char c) -> unsigned char { return std::tolower(c); });
+    MemoryBudget budget(memory_budget_mb * 1024 * 1024);
 
-    if ( !check_extension(input_file_lower, ".jpg")
-        && !check_extension(input_file_lower, ".jpeg")
-        && !check_extension(input_file_lower, ".heic"))
+    ExtractorHelpers::ExtractOptions options;
+    options.validate = parser.count("validate") != 0;
+    options.sha256 = parser.count("sha256") != 0;
+    options.metadata = parser.count("metadata") != 0;
+    options.copyChunkSize = static_cast<size_t>(copy_chunk_kb * 1024);
+    options.copyDepth = static_cast<size_t>(copy_depth);
+    if (parser.count("sef-entries"))
     {
-        std::cerr << R"(this application works only with ".jpg", ".jpeg" and ".heic" files.)" << std::endl;
-        return 3;
+        // "all" or entry names, e.g. Image_UTC_Data
+        for (const auto& name : parser.retrieve<std::vector<std::string>>("sef-entries"))
+        {
+            if (name == "all")
+            {
+                options.allSefEntries = true;
+            }
+            else
+            {
+                options.sefEntries.push_back(name);
+            }
+        }
+        if (parser.count("input") && !parser.count("list") && !parser.count("live-photos") && !parser.count("pack"))
+        {
+            // a single output file has no room for the entries
+            std::cerr << "--sef-entries writes several files, use it with --list or --pack" << std::endl;
+            return 2;
+        }
+    }
+    if (options.metadata && parser.count("pack") && !parser.count("manifest"))
+    {
+        // a pack has no room for sidecar files
+        std::cerr << "--metadata with --pack needs --manifest" << std::endl;
+        return 2;
     }
 
+    if (parser.count("simulate-latency"))
+    {
+        // benchmark the read planner as if inputs were in an object store
+        options.openReader = [latency_ms](const std::string& path) -> std::unique_ptr<HeifUtils::RangeReader> {
+            std::unique_ptr<HeifUtils::FileRangeReader> file(new HeifUtils::FileRangeReader(path));
+            if (!file->isOpen())
+            {
+                return nullptr;
+            }
+            return std::unique_ptr<HeifUtils::RangeReader>(
+                new LatencyRangeReader(std::move(file), std::chrono::milliseconds(latency_ms)));
+        };
+    }
 
+    DedupIndex dedup;
+    if (parser.count("dedup"))
+    {
+        options.dedup = &dedup;
+    }
 
-    if (check_extension(input_file_lower, ".heic"))
+    std::unique_ptr<Manifest> manifest;
+    if (parser.count("manifest"))
     {
-        HeifReader heif;
-        if (HeifHelpers::OperationResult::Ok != heif.load(input_file.c_str()))
+        manifest.reset(new Manifest(parser.retrieve<std::string>("manifest")));
+        if (!manifest->isOpen())
         {
-            std::cerr << "cannot read input file" << std::endl;
-            return 3;
+            std::cerr << "cannot open manifest file" << std::endl;
+            return 5;
         }
+        options.manifest = manifest.get();
+    }
+
+    ExtractorHelpers::OutputPolicy policy;
+    policy.preallocate = parser.count("preallocate") != 0;
+    policy.atomicRename = parser.count("atomic-rename") != 0;
+    if (parser.count("direct-io"))
+    {
+        // size in MiB, 0 for every payload
+        policy.directMinSize = direct_io_mb ? direct_io_mb * 1024 * 1024 : 1;
+    }
+    std::unique_ptr<SyncBatcher> sync;
+    if (sync_every || sync_interval_s)
+    {
+        sync.reset(new SyncBatcher(static_cast<size_t>(sync_every), std::chrono::seconds(sync_interval_s)));
+        policy.sync = sync.get();
+    }
+    if (parser.count("pack") && (policy.preallocate || policy.atomicRename || policy.directMinSize || policy.sync))
+    {
+        // a pack is one file appended under a lock, it has no per-file policy
+        std::cerr << "--preallocate, --atomic-rename, --sync-every, --sync-interval and --direct-io can't be used with --pack" << std::endl;
+        return 2;
+    }
 
-        SefdBox sf = heif.getSefdBox();
-        if (sf.getSize() != 0
-            && sf.getFtyp().getSize() != 0
-            && sf.getFtyp().GetMajorBand() == "mp42"
-            && sf.getMdat().getSize() != 0
-            && sf.getMdat().startPosition() != 0
-            && sf.getMdat().endPosition() != 0)
+    std::unique_ptr<OutputSink> sink;
+    if (parser.count("pack"))
+    {
+        std::unique_ptr<PackSink> pack(new PackSink(output_file));
+        if (!pack->open())
         {
-            std::vector<uint8_t> videoData;
-            videoData.resize(sf.getSize() - sf.getFtypStartPos());
-            std::shared_ptr<std::ifstream> imgFile(new std::ifstream(input_file.c_str(), std::ifstream::in | std::ifstream::binary), [](std::ifstream* p) {if (p) { p->close(), delete p; }});
-            if (imgFile->bad())
+            std::cerr << "cannot append to " << output_file << ": it can't be opened, or it has no "
+                      << PackSink::indexPath(output_file) << " and is no pack" << std::endl;
+            return 5;
+        }
+        sink = std::move(pack);
+    }
+    else if (parser.count("list") || parser.count("live-photos"))
+    {
+        sink.reset(new DirectorySink(output_file, policy));
+    }
+    else
+    {
+        sink.reset(new FileSink(output_file, policy));
+    }
+
+    const bool live_photos = parser.count("live-photos") != 0;
+    if (parser.count("list") || live_photos)
+    {
+        std::string root = parser.count("root") ? parser.retrieve<std::string>("root") : std::string();
+        std::vector<std::string> listed;
+        if (parser.count("list"))
+        {
+            if (!BatchRunner::readList(parser.retrieve<std::string>("list"), listed))
+            {
+                std::cerr << "cannot read input list" << std::endl;
+                return 3;
+            }
+        }
+        else
+        {
+            // without a list the input is the tree to pair
+            root = parser.retrieve<std::string>("input");
+            if (!PlatformFile::listFiles(root, listed))
             {
-                std::cerr << "cannot read input file" << std::endl;
+                std::cerr << "cannot read input directory" << std::endl;
                 return 3;
             }
+        }
+
+        ShardSpec shard;
+        if (parser.count("shard") && live_photos)
+        {
+            // a still and its movie may hash to different shards
+            std::cerr << "--shard can't be used with --live-photos" << std::endl;
+            return 2;
+        }
+        if (parser.count("shard") && !ShardSpec::parse(parser.retrieve<std::string>("shard"), shard))
+        {
+            std::cerr << "--shard expects i/N with i < N" << std::endl;
+            return 2;
+        }
+
+        const std::string io_order = parser.count("io-order") ? parser.retrieve<std::string>("io-order") : "list";
+        if (io_order != "list" && io_order != "physical")
+        {
+            std::cerr << "--io-order expects list or physical" << std::endl;
+            return 2;
+        }
+        if (io_order == "physical" && live_photos)
+        {
+            // pairs are read in the order the index matched them
+            std::cerr << "--io-order physical can't be used with --live-photos" << std::endl;
+            return 2;
+        }
 
-            imgFile->seekg(heif.getSefdOffset() + sf.getFtypStartPos());
-            imgFile->read(reinterpret_cast<char*>(&videoData[0]), videoData.size());
-            std::ofstream ofile(output_file.c_str(), std::ios::binary);
-            if (ofile.bad())
+        std::unique_ptr<Checkpoint> checkpoint;
+        if (parser.count("checkpoint"))
+        {
+            checkpoint.reset(new Checkpoint(parser.retrieve<std::string>("checkpoint")));
+            if (!checkpoint->load() || !checkpoint->open())
             {
-                std::cerr << "cannot open out file" << std::endl;
+                std::cerr << "cannot open checkpoint file" << std::endl;
                 return 5;
             }
-            ofile.write((char*)(videoData.data()), videoData.size());
-            ofile.close();
         }
-        else
+
+        BatchStats stats;
+        std::vector<std::string> shardInputs;
+        std::vector<std::string> inputs;
+        for (const auto& input : listed)
         {
-            std::cerr << "there is no any video in this file" << std::endl;
-            return 4;
+            if (!shard.contains(input))
+            {
+                continue;
+            }
+            shardInputs.push_back(input);
+            // the pairing index needs every file, done pairs are dropped after it
+            if (live_photos || !checkpoint || !checkpoint->isDone(input))
+            {
+                inputs.push_back(input);
+            }
         }
-    }
-    else
-    {
-        std::shared_ptr<std::ifstream> imgFile(new std::ifstream(input_file.c_str(), std::ifstream::in | std::ifstream::binary), [](std::ifstream* p) {if (p) { p->close(), delete p; }});
-        if (imgFile->bad())
+        if (checkpoint)
         {
-            std::cerr << "cannot read input file" << std::endl;
-            return 3;
+            // work finished before a restart still belongs in the node report
+            checkpoint->addRecordedStats(shardInputs, stats);
         }
-        imgFile->seekg(0, std::ios::end);
-        std::streampos length = imgFile->tellg();
-        imgFile->seekg(0, std::ios::beg);
-        std::vector<uint8_t> data(length);
-        imgFile->read((char*)data.data(), length);
 
-        auto exif_info = TinyEXIF::EXIFInfo(data.data(), length);
-        if (exif_info.Fields)
+        std::vector<LivePhotoPair> pairs;
+        if (live_photos)
         {
-            exif_info.parseFromXMPSegment(data.data(), length);
-            if (exif_info.MicroVideo.HasMicroVideo)
+            LivePhotoIndex index(static_cast<unsigned int>(jobs), budget, options.openReader);
+            index.setRoot(root);
+            index.scan(inputs);
+            for (const auto& pair : index.pairs())
             {
-                size_t offset = data.size() - exif_info.MicroVideo.MicroVideoOffset;
-                std::ofstream ofile(output_file.c_str(), std::ios::binary);
-                if (ofile.bad())
+                if (!checkpoint || !checkpoint->isDone(pair.still))
                 {
-                    std::cerr << "cannot open out file" << std::endl;
-                    return 5;
+                    pairs.push_back(pair);
                 }
-                offset = data.size() - exif_info.MicroVideo.MicroVideoOffset;
-                ofile.write((char*)(data.data() + offset), data.size() - offset);
-                ofile.close();
-            }
-            else
-            {
-                std::cerr << "there is no any video in this file" << std::endl;
-                return 4;
             }
+            stats.noVideo += index.unpairedStills();
+            stats.readRequests += index.readRequests();
+            std::cout << "live photos: " << index.pairs().size() << " paired, "
+                      << index.unpairedStills() << " stills without video, "
+                      << index.unpairedMovies() << " videos without still" << std::endl;
+        }
+
+        if (io_order == "physical")
+        {
+            IoOrder::Method method = IoOrder::sortByPhysicalLayout(inputs, root);
+            std::cout << "reading in " << IoOrder::methodName(method) << std::endl;
+            // photo plus clip fits, so each file is one sequential read
+            options.wholeFileReadLimit = 32 * 1024 * 1024;
+        }
+
+        BufferPool pool(budget, BufferPool::DEFAULT_BUFFER_SIZE, static_cast<size_t>(jobs));
+        BatchRunner runner(*sink, pool, static_cast<unsigned int>(jobs), options);
+        runner.setRoot(root);
+        runner.setCheckpoint(checkpoint.get());
+        stats += live_photos ? runner.runPairs(pairs) : runner.run(inputs);
+        std::cout << "extracted: " << stats.extracted
+                  << ", no video: " << stats.noVideo
+                  << ", invalid: " << stats.invalid
+                  << ", unsupported: " << stats.unsupported
+                  << ", failed: " << stats.failed << std::endl;
+        if (parser.count("simulate-latency"))
+        {
+            std::cout << "read requests: " << stats.readRequests << std::endl;
+        }
+        if (!sink->flush())
+        {
+            std::cerr << "cannot sync output files" << std::endl;
+            return 5;
+        }
+        if (manifest && !manifest->isOpen())
+        {
+            std::cerr << "cannot write manifest file" << std::endl;
+            return 5;
+        }
+        if (checkpoint && !checkpoint->isOpen())
+        {
+            std::cerr << "cannot write checkpoint file" << std::endl;
+            return 5;
+        }
+        if (parser.count("report") && !BatchReport::write(parser.retrieve<std::string>("report"), stats))
+        {
+            std::cerr << "cannot write report" << std::endl;
+            return 5;
         }
+        return (stats.failed || stats.invalid) ? 3 : 0;
+    }
+
+    std::string input_file = parser.retrieve<std::string>("input");
+
+    if (!VideoExtractor::isSupported(input_file))
+    {
+        std::cerr << R"(this application works only with ".jpg", ".jpeg" and ".heic" files.)" << std::endl;
+        return 3;
     }
 
+    BufferPool pool(budget, BufferPool::DEFAULT_BUFFER_SIZE, 1);
+    VideoExtractor extractor(*sink, pool, options);
+    switch (extractor.extract(input_file))
+    {
+    case ExtractorHelpers::ExtractResult::Ok:
+        break;
+    case ExtractorHelpers::ExtractResult::NO_VIDEO:
+        std::cerr << "there is no any video in this file" << std::endl;
+        return 4;
+    case ExtractorHelpers::ExtractResult::WRITE_ERROR:
+        std::cerr << "cannot open out file" << std::endl;
+        return 5;
+    case ExtractorHelpers::ExtractResult::INVALID_VIDEO:
+        std::cerr << "embedded video is corrupt: " << HeifHelpers::validationMessage(extractor.lastValidation()) << std::endl;
+        return 6;
+    default:
+        std::cerr << "cannot read input file" << std::endl;
+        return 3;
+    }
+
+    if (parser.count("simulate-latency"))
+    {
+        std::cout << "read requests: " << extractor.lastReadRequests() << std::endl;
+    }
+    if (!sink->flush())
+    {
+        std::cerr << "cannot sync output file" << std::endl;
+        return 5;
+    }
     std::cout << "job is done" << std::endl;
     return 0;
 }